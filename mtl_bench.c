@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <utmpx.h>
+
+#include <sys/stat.h>
+
+#include "src/mtl.h"
+#include "src/group.h"
+#include "src/stats.h"
+#include "src/utils.h"
+
+#ifndef NSS_MTL_BENCH_DIR
+#error "NSS_MTL_BENCH_DIR must be defined, fixtures are written there"
+#endif
+
+#define BENCH_TARGET_USER "bench-target"
+#define BENCH_TARGET_UID 60000
+#define BENCH_BUFLEN (1024 * 1024)
+/* initial buffer size used by glibc for group lookups */
+#define BENCH_GLIBC_BUFLEN 1024
+
+typedef struct {
+	size_t users;
+	size_t groups;
+	size_t sessions;
+	size_t members;
+	size_t iterations;
+	uint64_t seed;
+} bench_params_t;
+
+typedef struct {
+	const char* name;
+	size_t calls;
+	size_t failures;
+	uint64_t* samples;
+	uint64_t total;
+} bench_result_t;
+
+static uint64_t bench_state = 88172645463325252ull;
+
+static uint64_t bench_random(void) {
+	/* xorshift64, good enough to pick names */
+	bench_state ^= bench_state << 13;
+	bench_state ^= bench_state >> 7;
+	bench_state ^= bench_state << 17;
+	return bench_state;
+}
+
+static uint64_t bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static FILE* bench_open(const char* path) {
+	FILE* f = fopen(path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	return f;
+}
+
+static void bench_close(FILE* f, const char* path) {
+	if (fclose(f) != 0) {
+		fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void bench_generate(const bench_params_t* params) {
+	if (mkdir(NSS_MTL_BENCH_DIR, 0755) == -1 && errno != EEXIST) {
+		fprintf(stderr, "Cannot create %s: %s\n", NSS_MTL_BENCH_DIR, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	FILE* f = bench_open(NSS_MTL_CONFIG_FILE);
+	fprintf(f, "log_level = err\n");
+	fprintf(f, "target_user = %s\n", BENCH_TARGET_USER);
+	fprintf(f, "ignored_users = root");
+	for (size_t i = 0; i < params->users; i += 100) {
+		fprintf(f, ",user%zu", i);
+	}
+	fprintf(f, "\nignored_execs = useradd,usermod\n");
+	bench_close(f, NSS_MTL_CONFIG_FILE);
+
+	f = bench_open(NSS_MTL_PASSWD_FILE);
+	fprintf(f, "root:x:0:0:root:/root:/bin/bash\n");
+	for (size_t i = 0; i < params->users; ++i) {
+		fprintf(f, "user%zu:x:%zu:%zu:Bench User %zu,,,:/home/user%zu:/bin/bash\n", i, 1000 + i, 1000 + i, i, i);
+	}
+	fprintf(f, "%s:x:%d:%d:Remote User,,,:/home/%s:/bin/bash\n", BENCH_TARGET_USER, BENCH_TARGET_UID, BENCH_TARGET_UID, BENCH_TARGET_USER);
+	bench_close(f, NSS_MTL_PASSWD_FILE);
+
+	f = bench_open(NSS_MTL_GROUP_FILE);
+	fprintf(f, "root:x:0:\n");
+	for (size_t i = 0; i < params->groups; ++i) {
+		fprintf(f, "group%zu:x:%zu:", i, 10000 + i);
+		for (size_t k = 0; k < params->members && params->users > 0; ++k) {
+			fprintf(f, "%suser%lu", k > 0 ? "," : "", (unsigned long)(bench_random() % params->users));
+		}
+		/* every tenth group is expanded with active users */
+		if (i % 10 == 0) {
+			fprintf(f, "%s%s", params->members > 0 && params->users > 0 ? "," : "", BENCH_TARGET_USER);
+		}
+		fprintf(f, "\n");
+	}
+	fprintf(f, "%s:x:%d:\n", BENCH_TARGET_USER, BENCH_TARGET_UID);
+	bench_close(f, NSS_MTL_GROUP_FILE);
+
+	f = bench_open(NSS_MTL_UTMP_FILE);
+	for (size_t i = 0; i < params->sessions; ++i) {
+		struct utmpx ut;
+		memset(&ut, 0, sizeof(ut));
+		ut.ut_type = USER_PROCESS;
+		ut.ut_pid = 1000 + i;
+		/* mostly remote users, with some local ones which get filtered out */
+		if (i % 4 == 0 && params->users > 0) {
+			snprintf(ut.ut_user, sizeof(ut.ut_user), "user%zu", i % params->users);
+		} else {
+			snprintf(ut.ut_user, sizeof(ut.ut_user), "remote%zu", i);
+		}
+		snprintf(ut.ut_line, sizeof(ut.ut_line), "pts/%zu", i);
+		fwrite(&ut, sizeof(ut), 1, f);
+	}
+	bench_close(f, NSS_MTL_UTMP_FILE);
+}
+
+static void bench_touch(const char* path) {
+	/* unique mtime on every call, so that the module has to reload */
+	static long counter = 0;
+	++counter;
+	const struct timespec times[2] = { { .tv_sec = 1000000000 + counter }, { .tv_sec = 1000000000 + counter } };
+	utimensat(AT_FDCWD, path, times, 0);
+}
+
+static int bench_compare(const void* a, const void* b) {
+	const uint64_t x = *(const uint64_t*)a;
+	const uint64_t y = *(const uint64_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+static void bench_begin(bench_result_t* result, const char* name, size_t calls) {
+	memset(result, 0, sizeof(*result));
+	result->name = name;
+	result->calls = calls;
+	result->samples = calloc(calls > 0 ? calls : 1, sizeof(uint64_t));
+	if (result->samples == NULL) {
+		fprintf(stderr, "Cannot allocate samples for %zu calls\n", calls);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void bench_report(bench_result_t* result) {
+	qsort(result->samples, result->calls, sizeof(uint64_t), bench_compare);
+	const uint64_t p50 = result->calls > 0 ? result->samples[result->calls / 2] : 0;
+	const uint64_t p99 = result->calls > 0 ? result->samples[(result->calls * 99) / 100] : 0;
+	const double ops = result->total > 0 ? (double)result->calls * 1e9 / (double)result->total : 0.0;
+
+	printf("%s\t%zu\t%zu\t%lu\t%lu\t%.0f\n", result->name, result->calls, result->failures, (unsigned long)p50, (unsigned long)p99, ops);
+	free(result->samples);
+}
+
+static void bench_sample(bench_result_t* result, size_t i, uint64_t start, bool ok) {
+	const uint64_t elapsed = bench_now() - start;
+	result->samples[i] = elapsed;
+	result->total += elapsed;
+	if (! ok) {
+		++result->failures;
+	}
+}
+
+static void bench_run(const bench_params_t* params, char* buffer) {
+	const size_t n = params->iterations;
+	char name[64];
+	int errnop = 0;
+	bench_result_t result;
+
+	bench_begin(&result, "getpwnam_r", n);
+	for (size_t i = 0; i < n; ++i) {
+		struct passwd pw;
+		snprintf(name, sizeof(name), "remote%lu", (unsigned long)(bench_random() % 100000));
+		const uint64_t start = bench_now();
+		const enum nss_status status = _nss_mtl_getpwnam_r(name, &pw, buffer, BENCH_BUFLEN, &errnop);
+		bench_sample(&result, i, start, status == NSS_STATUS_SUCCESS);
+	}
+	bench_report(&result);
+
+	bench_begin(&result, "getpwnam_r/local", params->users > 0 ? n : 0);
+	for (size_t i = 0; i < result.calls; ++i) {
+		struct passwd pw;
+		snprintf(name, sizeof(name), "user%lu", (unsigned long)(bench_random() % params->users));
+		const uint64_t start = bench_now();
+		const enum nss_status status = _nss_mtl_getpwnam_r(name, &pw, buffer, BENCH_BUFLEN, &errnop);
+		bench_sample(&result, i, start, status == NSS_STATUS_UNAVAIL);
+	}
+	bench_report(&result);
+
+	/* every call sees changed passwd and config, as short-lived processes do */
+	const size_t cold = n / 100 > 10 ? n / 100 : 10;
+	bench_begin(&result, "getpwnam_r/cold", cold);
+	for (size_t i = 0; i < cold; ++i) {
+		struct passwd pw;
+		snprintf(name, sizeof(name), "remote%lu", (unsigned long)(bench_random() % 100000));
+		bench_touch(NSS_MTL_PASSWD_FILE);
+		bench_touch(NSS_MTL_CONFIG_FILE);
+		const uint64_t start = bench_now();
+		const enum nss_status status = _nss_mtl_getpwnam_r(name, &pw, buffer, BENCH_BUFLEN, &errnop);
+		bench_sample(&result, i, start, status == NSS_STATUS_SUCCESS);
+	}
+	bench_report(&result);
+
+	bench_begin(&result, "getspnam_r", n);
+	for (size_t i = 0; i < n; ++i) {
+		struct spwd spw;
+		snprintf(name, sizeof(name), "remote%lu", (unsigned long)(bench_random() % 100000));
+		const uint64_t start = bench_now();
+		const enum nss_status status = _nss_mtl_getspnam_r(name, &spw, buffer, BENCH_BUFLEN, &errnop);
+		bench_sample(&result, i, start, status == NSS_STATUS_SUCCESS);
+	}
+	bench_report(&result);
+
+	bench_begin(&result, "getgrnam_r", params->groups > 0 ? n : 0);
+	for (size_t i = 0; i < result.calls; ++i) {
+		struct group grp;
+		snprintf(name, sizeof(name), "group%lu", (unsigned long)(bench_random() % params->groups));
+		const uint64_t start = bench_now();
+		const enum nss_status status = _nss_mtl_getgrnam_r(name, &grp, buffer, BENCH_BUFLEN, &errnop);
+		bench_sample(&result, i, start, status == NSS_STATUS_SUCCESS);
+	}
+	bench_report(&result);
+
+	/* expanded groups looked up the way glibc does, doubling the buffer on ERANGE */
+	bench_begin(&result, "getgrnam_r/erange", params->groups > 0 ? n : 0);
+	for (size_t i = 0; i < result.calls; ++i) {
+		struct group grp;
+		snprintf(name, sizeof(name), "group%lu", (unsigned long)((bench_random() % ((params->groups + 9) / 10)) * 10));
+		const uint64_t start = bench_now();
+		enum nss_status status = NSS_STATUS_TRYAGAIN;
+		errnop = ERANGE;
+		for (size_t buflen = BENCH_GLIBC_BUFLEN; status == NSS_STATUS_TRYAGAIN && errnop == ERANGE && buflen <= BENCH_BUFLEN; buflen *= 2) {
+			status = _nss_mtl_getgrnam_r(name, &grp, buffer, buflen, &errnop);
+		}
+		bench_sample(&result, i, start, status == NSS_STATUS_SUCCESS);
+	}
+	bench_report(&result);
+
+	bench_begin(&result, "getgrgid_r", params->groups > 0 ? n : 0);
+	for (size_t i = 0; i < result.calls; ++i) {
+		struct group grp;
+		const gid_t gid = 10000 + bench_random() % params->groups;
+		const uint64_t start = bench_now();
+		const enum nss_status status = _nss_mtl_getgrgid_r(gid, &grp, buffer, BENCH_BUFLEN, &errnop);
+		bench_sample(&result, i, start, status == NSS_STATUS_SUCCESS);
+	}
+	bench_report(&result);
+
+	/* one call per entry, starting over when the database ends */
+	bench_begin(&result, "getgrent_r", n);
+	_nss_mtl_setgrent();
+	for (size_t i = 0; i < n; ++i) {
+		struct group grp;
+		const uint64_t start = bench_now();
+		enum nss_status status = _nss_mtl_getgrent_r(&grp, buffer, BENCH_BUFLEN, &errnop);
+		if (status == NSS_STATUS_NOTFOUND) {
+			_nss_mtl_setgrent();
+			status = _nss_mtl_getgrent_r(&grp, buffer, BENCH_BUFLEN, &errnop);
+		}
+		bench_sample(&result, i, start, status == NSS_STATUS_SUCCESS);
+	}
+	_nss_mtl_endgrent();
+	bench_report(&result);
+
+	bench_begin(&result, "initgroups_dyn", n);
+	for (size_t i = 0; i < n; ++i) {
+		long int start_idx = 0;
+		long int size = 16;
+		gid_t* groups = malloc(size * sizeof(gid_t));
+		snprintf(name, sizeof(name), "remote%lu", (unsigned long)(bench_random() % 100000));
+		const uint64_t start = bench_now();
+		const enum nss_status status = _nss_mtl_initgroups_dyn(name, BENCH_TARGET_UID, &start_idx, &size, &groups, 0, &errnop);
+		bench_sample(&result, i, start, status == NSS_STATUS_SUCCESS);
+		free(groups);
+	}
+	bench_report(&result);
+}
+
+int main(int argc, char* argv[]) {
+	bench_params_t params = {
+		.users = 10000,
+		.groups = 5000,
+		.sessions = 500,
+		.members = 8,
+		.iterations = 10000,
+		.seed = 1,
+	};
+	bool generate = true;
+	bool generate_only = false;
+	bool stats = false;
+
+	int opt = 0;
+	while ((opt = getopt(argc, argv, "u:g:s:m:n:r:kGS")) != -1) {
+		switch (opt) {
+		case 'u':
+			params.users = strtoul(optarg, NULL, 10);
+			break;
+		case 'g':
+			params.groups = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			params.sessions = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			params.members = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			params.iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			params.seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'k':
+			generate = false;
+			break;
+		case 'G':
+			generate_only = true;
+			break;
+		case 'S':
+			stats = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-u <users>] [-g <groups>] [-s <sessions>] [-m <members per group>] [-n <iterations>] [-r <seed>] [-k] [-G] [-S]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (params.seed != 0) {
+		bench_state = params.seed;
+	}
+
+	if (generate) {
+		bench_generate(&params);
+	}
+	if (generate_only) {
+		/* fixtures for mtl_stress */
+		return EXIT_SUCCESS;
+	}
+	if (stats) {
+		/* must exist before first lookup, module attaches to it only once */
+		nss_mtl_stats_t* counters = nss_mtl_stats_map(NSS_MTL_STATS_FILE, true);
+		if (counters == NULL) {
+			fprintf(stderr, "Cannot create %s\n", NSS_MTL_STATS_FILE);
+			return EXIT_FAILURE;
+		}
+		nss_mtl_stats_reset(counters);
+		nss_mtl_stats_unmap(counters);
+	}
+
+	char* buffer = malloc(BENCH_BUFLEN);
+	if (buffer == NULL) {
+		fprintf(stderr, "Cannot allocate lookup buffer\n");
+		return EXIT_FAILURE;
+	}
+
+	/* tab separated, so that runs of different versions can be diffed */
+	printf("# users=%zu groups=%zu sessions=%zu members=%zu iterations=%zu seed=%lu\n", params.users, params.groups, params.sessions, params.members, params.iterations, (unsigned long)params.seed);
+	printf("# entry\tcalls\tfailures\tp50_ns\tp99_ns\tops_per_sec\n");
+	bench_run(&params, buffer);
+
+	free(buffer);
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "src/config.h"
+#include "src/db.h"
+#include "src/group.h"
+#include "src/passwd.h"
+
+static bool add_memberships(const nss_mtl_config_t* config, const nss_mtl_group_t* group, nss_mtl_db_membership_t* memberships, size_t* count, gid_t** gids, size_t* gids_count) {
+	for (size_t target = 0; target < config->targets_count; ++target) {
+		const char* user = config->targets[target];
+		if (strlen(user) >= NSS_MTL_DB_NAME_SIZE) {
+			fprintf(stderr, "Target user %s has too long name, its groups are left for lookup time\n", user);
+			continue;
+		}
+
+		const nss_mtl_group_membership_t* membership = nss_mtl_group_membership_acquire(group, user);
+		if (membership == NULL) {
+			fprintf(stderr, "Cannot find groups of %s\n", user);
+			return false;
+		}
+		gid_t* grown = realloc(*gids, (*gids_count + membership->count + 1) * sizeof(gid_t));
+		if (grown == NULL) {
+			fprintf(stderr, "Cannot allocate groups of %s\n", user);
+			nss_mtl_group_membership_release(membership);
+			return false;
+		}
+		*gids = grown;
+
+		nss_mtl_db_membership_t* stored = &memberships[(*count)++];
+		memset(stored, 0, sizeof(nss_mtl_db_membership_t));
+		strcpy(stored->user, user);
+		stored->first = *gids_count;
+		stored->count = membership->count;
+		memcpy(*gids + *gids_count, membership->gids, membership->count * sizeof(gid_t));
+		*gids_count += membership->count;
+		nss_mtl_group_membership_release(membership);
+	}
+
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	const char* conf = NULL;
+	const char* path = NSS_MTL_DB_FILE;
+
+	int opt = 0;
+	while ((opt = getopt(argc, argv, "c:o:")) != -1) {
+		switch (opt) {
+		case 'c':
+			conf = optarg;
+			break;
+		case 'o':
+			path = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c <config_file>] [-o <db_file>]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	nss_mtl_config_t* config = nss_mtl_config_parse(conf);
+	const nss_mtl_passwd_t* passwd = nss_mtl_passwd_acquire();
+	const nss_mtl_group_t* group = nss_mtl_group_acquire();
+	if (config == NULL || passwd == NULL || group == NULL || ! nss_mtl_passwd_index(passwd)) {
+		fprintf(stderr, "Cannot read %s, %s or %s\n", conf != NULL ? conf : "config", NSS_MTL_PASSWD_FILE, NSS_MTL_GROUP_FILE);
+		return EXIT_FAILURE;
+	}
+
+	nss_mtl_db_membership_t memberships[NSS_MTL_CONFIG_MAX_TARGETS];
+	size_t memberships_count = 0;
+	gid_t* gids = NULL;
+	size_t gids_count = 0;
+	if (! add_memberships(config, group, memberships, &memberships_count, &gids, &gids_count)) {
+		return EXIT_FAILURE;
+	}
+
+	/* stamps were taken before the files were read, so a concurrent edit leaves the database stale rather than wrong */
+	nss_mtl_db_header_t header;
+	memset(&header, 0, sizeof(header));
+	header.passwd_stamp = passwd->snapshot.stamp;
+	header.group_stamp = group->snapshot.stamp;
+
+	const void* sections[NSS_MTL_DB_SECTIONS] = {
+		[NSS_MTL_DB_PASSWD_DATA] = passwd->data,
+		[NSS_MTL_DB_PASSWD_ENTRIES] = passwd->entries,
+		[NSS_MTL_DB_PASSWD_TABLE] = passwd->table,
+		[NSS_MTL_DB_GROUP_DATA] = group->data,
+		[NSS_MTL_DB_GROUP_ENTRIES] = group->entries,
+		[NSS_MTL_DB_GROUP_BY_NAME] = group->by_name,
+		[NSS_MTL_DB_GROUP_BY_GID] = group->by_gid,
+		[NSS_MTL_DB_MEMBERSHIPS] = memberships,
+		[NSS_MTL_DB_MEMBERSHIP_GIDS] = gids,
+	};
+	header.sections[NSS_MTL_DB_PASSWD_DATA].size = passwd->size;
+	header.sections[NSS_MTL_DB_PASSWD_ENTRIES].size = passwd->count * sizeof(nss_mtl_passwd_entry_t);
+	header.sections[NSS_MTL_DB_PASSWD_TABLE].size = (passwd->mask + 1) * sizeof(size_t);
+	header.sections[NSS_MTL_DB_GROUP_DATA].size = group->size;
+	header.sections[NSS_MTL_DB_GROUP_ENTRIES].size = group->count * sizeof(nss_mtl_group_entry_t);
+	header.sections[NSS_MTL_DB_GROUP_BY_NAME].size = (group->mask + 1) * sizeof(size_t);
+	header.sections[NSS_MTL_DB_GROUP_BY_GID].size = (group->mask + 1) * sizeof(size_t);
+	header.sections[NSS_MTL_DB_MEMBERSHIPS].size = memberships_count * sizeof(nss_mtl_db_membership_t);
+	header.sections[NSS_MTL_DB_MEMBERSHIP_GIDS].size = gids_count * sizeof(gid_t);
+
+	if (! nss_mtl_db_write(path, &header, sections)) {
+		fprintf(stderr, "Cannot write %s\n", path);
+		return EXIT_FAILURE;
+	}
+	printf("%s: %lu users, %lu groups, %lu target users\n", path, passwd->count, group->count, memberships_count);
+
+	free(gids);
+	nss_mtl_group_release(group);
+	nss_mtl_passwd_release(passwd);
+	nss_mtl_config_free(config);
+
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "src/stats.h"
+
+static uint64_t percentile(const nss_mtl_stats_total_t* total, unsigned int pct) {
+	/* upper bound of the bucket holding requested percentile, in nanoseconds */
+	const uint64_t wanted = (total->calls * pct + 99) / 100;
+	uint64_t seen = 0;
+	for (int i = 0; i < NSS_MTL_STATS_BUCKETS; ++i) {
+		seen += total->histogram[i];
+		if (seen >= wanted && seen > 0) {
+			return 2ull << i;
+		}
+	}
+
+	return 0;
+}
+
+static void subtract(nss_mtl_stats_total_t* total, const nss_mtl_stats_total_t* prev) {
+	total->calls -= prev->calls;
+	for (int i = 0; i < NSS_MTL_STATS_RESULTS; ++i) {
+		total->results[i] -= prev->results[i];
+	}
+	total->nanoseconds -= prev->nanoseconds;
+	total->bytes -= prev->bytes;
+	for (int i = 0; i < NSS_MTL_STATS_BUCKETS; ++i) {
+		total->histogram[i] -= prev->histogram[i];
+	}
+}
+
+static void print_header(void) {
+	printf("%-12s %10s %10s %10s %10s %10s %10s %10s %10s %10s %12s\n",
+		"op", "calls", "success", "notfound", "unavail", "tryagain", "erange", "avg_us", "p50_us", "p99_us", "bytes");
+}
+
+static void print_total(nss_mtl_stats_op_t op, const nss_mtl_stats_total_t* total) {
+	const double avg = total->calls > 0 ? (double)total->nanoseconds / total->calls / 1000.0 : 0.0;
+	printf("%-12s %10lu %10lu %10lu %10lu %10lu %10lu %10.1f %10.1f %10.1f %12lu\n",
+		nss_mtl_stats_op_name(op),
+		(unsigned long)total->calls,
+		(unsigned long)total->results[NSS_MTL_STATS_SUCCESS],
+		(unsigned long)total->results[NSS_MTL_STATS_NOTFOUND],
+		(unsigned long)total->results[NSS_MTL_STATS_UNAVAIL],
+		(unsigned long)total->results[NSS_MTL_STATS_TRYAGAIN],
+		(unsigned long)total->results[NSS_MTL_STATS_ERANGE],
+		avg,
+		percentile(total, 50) / 1000.0,
+		percentile(total, 99) / 1000.0,
+		(unsigned long)total->bytes);
+}
+
+int main(int argc, char* argv[]) {
+	const char* path = NSS_MTL_STATS_FILE;
+	bool create = false;
+	mode_t mode = 0644;
+	bool reset = false;
+	unsigned int interval = 0;
+
+	int opt = 0;
+	while ((opt = getopt(argc, argv, "f:im:zw:")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'i':
+			create = true;
+			break;
+		case 'm':
+			mode = strtoul(optarg, NULL, 8) & 0666;
+			break;
+		case 'z':
+			reset = true;
+			break;
+		case 'w':
+			interval = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-f <stats_file>] [-i [-m <mode>]] [-z] [-w <seconds>]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	nss_mtl_stats_t* stats = nss_mtl_stats_map(path, create);
+	if (stats == NULL) {
+		fprintf(stderr, "Cannot map %s, create it with -i\n", path);
+		return EXIT_FAILURE;
+	}
+
+	/* processes without write access to the file are not counted, so the mode decides which ones are */
+	if (create && chmod(path, mode) == -1) {
+		fprintf(stderr, "Cannot set mode of %s\n", path);
+		nss_mtl_stats_unmap(stats);
+		return EXIT_FAILURE;
+	}
+	if (reset) {
+		nss_mtl_stats_reset(stats);
+	}
+	if (create || reset) {
+		nss_mtl_stats_unmap(stats);
+		return EXIT_SUCCESS;
+	}
+
+	nss_mtl_stats_total_t prev[NSS_MTL_STATS_OPS];
+	memset(prev, 0, sizeof(prev));
+	do {
+		/* in watch mode every table shows what happened since previous one */
+		print_header();
+		for (int op = 0; op < NSS_MTL_STATS_OPS; ++op) {
+			nss_mtl_stats_total_t total;
+			nss_mtl_stats_sum(stats, op, &total);
+			nss_mtl_stats_total_t delta = total;
+			subtract(&delta, &prev[op]);
+			prev[op] = total;
+			print_total(op, &delta);
+		}
+		if (interval > 0) {
+			printf("\n");
+			fflush(stdout);
+			sleep(interval);
+		}
+	} while (interval > 0);
+
+	nss_mtl_stats_unmap(stats);
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
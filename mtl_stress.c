@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <nss.h>
+#include <pwd.h>
+#include <grp.h>
+#include <shadow.h>
+
+#include <sys/wait.h>
+
+#ifndef NSS_MTL_BENCH_DIR
+#error "NSS_MTL_BENCH_DIR must be defined, fixtures generated by mtl_bench are read from there"
+#endif
+
+#define STRESS_BUFLEN (1024 * 1024)
+#define STRESS_MAX_THREADS 256
+/* enumeration reads only a part of the database, so that it does not dominate the mix */
+#define STRESS_GRENT_ENTRIES 16
+
+typedef enum {
+	STRESS_PWNAM = 0,
+	STRESS_SPNAM,
+	STRESS_GRNAM,
+	STRESS_GRGID,
+	STRESS_GRENT,
+	STRESS_OPS,
+} stress_op_t;
+
+static const char* stress_op_names[STRESS_OPS] = {
+	[STRESS_PWNAM] = "pw",
+	[STRESS_SPNAM] = "sp",
+	[STRESS_GRNAM] = "gr",
+	[STRESS_GRGID] = "gid",
+	[STRESS_GRENT] = "ent",
+};
+
+/* entry points resolved from the library under test */
+typedef struct {
+	enum nss_status (*getpwnam_r)(const char* name, struct passwd* pw, char* buffer, size_t buflen, int* errnop);
+	enum nss_status (*getspnam_r)(const char* name, struct spwd* spw, char* buffer, size_t buflen, int* errnop);
+	enum nss_status (*getgrnam_r)(const char* name, struct group* grp, char* buffer, size_t buflen, int* errnop);
+	enum nss_status (*getgrgid_r)(gid_t gid, struct group* grp, char* buffer, size_t buflen, int* errnop);
+	enum nss_status (*setgrent)(void);
+	enum nss_status (*getgrent_r)(struct group* grp, char* buffer, size_t buflen, int* errnop);
+	enum nss_status (*endgrent)(void);
+} stress_api_t;
+
+typedef struct {
+	char** names;
+	gid_t* gids;
+	size_t count;
+} stress_groups_t;
+
+typedef struct {
+	unsigned int weights[STRESS_OPS];
+	unsigned int total_weight;
+	unsigned int seconds;
+	size_t users;
+} stress_params_t;
+
+/* what a single run sends back from its child process */
+typedef struct {
+	uint64_t calls[STRESS_OPS];
+	uint64_t failures;
+	uint64_t mismatches;
+	uint64_t nanoseconds;
+} stress_result_t;
+
+typedef struct {
+	pthread_t thread;
+	uint64_t state;
+	char* buffer;
+	stress_result_t result;
+} stress_worker_t;
+
+static stress_api_t stress_api;
+static stress_groups_t stress_groups;
+static stress_params_t stress_params;
+static atomic_bool stress_stop;
+
+static uint64_t stress_random(uint64_t* state) {
+	/* xorshift64, every worker has its own state */
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static uint64_t stress_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void* stress_symbol(void* library, const char* name) {
+	void* symbol = dlsym(library, name);
+	if (symbol == NULL) {
+		fprintf(stderr, "Cannot resolve %s: %s\n", name, dlerror());
+		exit(EXIT_FAILURE);
+	}
+
+	return symbol;
+}
+
+static void stress_load(const char* path) {
+	void* library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (library == NULL) {
+		fprintf(stderr, "Cannot load %s: %s\n", path, dlerror());
+		exit(EXIT_FAILURE);
+	}
+
+	*(void**)&stress_api.getpwnam_r = stress_symbol(library, "_nss_mtl_getpwnam_r");
+	*(void**)&stress_api.getspnam_r = stress_symbol(library, "_nss_mtl_getspnam_r");
+	*(void**)&stress_api.getgrnam_r = stress_symbol(library, "_nss_mtl_getgrnam_r");
+	*(void**)&stress_api.getgrgid_r = stress_symbol(library, "_nss_mtl_getgrgid_r");
+	*(void**)&stress_api.setgrent = stress_symbol(library, "_nss_mtl_setgrent");
+	*(void**)&stress_api.getgrent_r = stress_symbol(library, "_nss_mtl_getgrent_r");
+	*(void**)&stress_api.endgrent = stress_symbol(library, "_nss_mtl_endgrent");
+}
+
+static void stress_groups_read(void) {
+	FILE* f = fopen(NSS_MTL_GROUP_FILE, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open %s: %s, generate fixtures with mtl_bench -G\n", NSS_MTL_GROUP_FILE, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	char* line = NULL;
+	size_t size = 0;
+	size_t capacity = 0;
+	while (getline(&line, &size, f) != -1) {
+		char* gid = strchr(line, ':');
+		gid = gid != NULL ? strchr(gid + 1, ':') : NULL;
+		if (gid == NULL) {
+			continue;
+		}
+		if (stress_groups.count == capacity) {
+			capacity = capacity > 0 ? 2 * capacity : 1024;
+			stress_groups.names = realloc(stress_groups.names, capacity * sizeof(char*));
+			stress_groups.gids = realloc(stress_groups.gids, capacity * sizeof(gid_t));
+			if (stress_groups.names == NULL || stress_groups.gids == NULL) {
+				fprintf(stderr, "Cannot allocate buffer for %zu groups\n", capacity);
+				exit(EXIT_FAILURE);
+			}
+		}
+		stress_groups.names[stress_groups.count] = strndup(line, strchr(line, ':') - line);
+		stress_groups.gids[stress_groups.count] = strtoul(gid + 1, NULL, 10);
+		++stress_groups.count;
+	}
+	free(line);
+	fclose(f);
+
+	if (stress_groups.count == 0) {
+		fprintf(stderr, "No groups found in %s\n", NSS_MTL_GROUP_FILE);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static bool stress_in_buffer(const char* ptr, const char* buffer) {
+	return ptr >= buffer && ptr < buffer + STRESS_BUFLEN;
+}
+
+static bool stress_group_valid(const struct group* grp, const char* buffer) {
+	/* every pointer has to lead into the buffer given by the caller */
+	if (! stress_in_buffer(grp->gr_name, buffer) || ! stress_in_buffer(grp->gr_passwd, buffer) || ! stress_in_buffer((const char*)grp->gr_mem, buffer)) {
+		return false;
+	}
+	for (size_t i = 0; grp->gr_mem[i] != NULL; ++i) {
+		if (! stress_in_buffer(grp->gr_mem[i], buffer)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool stress_status_ok(enum nss_status status) {
+	return status == NSS_STATUS_SUCCESS || status == NSS_STATUS_NOTFOUND;
+}
+
+static void stress_call(stress_worker_t* worker, stress_op_t op) {
+	char* buffer = worker->buffer;
+	stress_result_t* result = &worker->result;
+	enum nss_status status = NSS_STATUS_SUCCESS;
+	int errnop = 0;
+	bool valid = true;
+	char name[64];
+
+	switch (op) {
+	case STRESS_PWNAM: {
+		struct passwd pw;
+		snprintf(name, sizeof(name), "remote%lu", (unsigned long)(stress_random(&worker->state) % stress_params.users));
+		status = stress_api.getpwnam_r(name, &pw, buffer, STRESS_BUFLEN, &errnop);
+		valid = status != NSS_STATUS_SUCCESS || (strcmp(pw.pw_name, name) == 0 && strstr(pw.pw_dir, name) != NULL);
+		break;
+	}
+	case STRESS_SPNAM: {
+		struct spwd spw;
+		snprintf(name, sizeof(name), "remote%lu", (unsigned long)(stress_random(&worker->state) % stress_params.users));
+		status = stress_api.getspnam_r(name, &spw, buffer, STRESS_BUFLEN, &errnop);
+		valid = status != NSS_STATUS_SUCCESS || strcmp(spw.sp_namp, name) == 0;
+		break;
+	}
+	case STRESS_GRNAM: {
+		struct group grp;
+		const size_t i = stress_random(&worker->state) % stress_groups.count;
+		status = stress_api.getgrnam_r(stress_groups.names[i], &grp, buffer, STRESS_BUFLEN, &errnop);
+		valid = status != NSS_STATUS_SUCCESS || (stress_group_valid(&grp, buffer) && strcmp(grp.gr_name, stress_groups.names[i]) == 0);
+		break;
+	}
+	case STRESS_GRGID: {
+		struct group grp;
+		const size_t i = stress_random(&worker->state) % stress_groups.count;
+		status = stress_api.getgrgid_r(stress_groups.gids[i], &grp, buffer, STRESS_BUFLEN, &errnop);
+		valid = status != NSS_STATUS_SUCCESS || (stress_group_valid(&grp, buffer) && grp.gr_gid == stress_groups.gids[i]);
+		break;
+	}
+	case STRESS_GRENT: {
+		/* cursor is shared by the process, so threads read each other's entries, which is fine */
+		struct group grp;
+		status = stress_api.setgrent();
+		for (int i = 0; status == NSS_STATUS_SUCCESS && i < STRESS_GRENT_ENTRIES; ++i) {
+			status = stress_api.getgrent_r(&grp, buffer, STRESS_BUFLEN, &errnop);
+			valid = valid && (status != NSS_STATUS_SUCCESS || stress_group_valid(&grp, buffer));
+		}
+		stress_api.endgrent();
+		break;
+	}
+	default:
+		break;
+	}
+
+	result->calls[op] += 1;
+	if (! stress_status_ok(status)) {
+		result->failures += 1;
+	}
+	if (! valid) {
+		result->mismatches += 1;
+	}
+}
+
+static void* stress_work(void* arg) {
+	stress_worker_t* worker = arg;
+	while (! atomic_load_explicit(&stress_stop, memory_order_relaxed)) {
+		unsigned int pick = stress_random(&worker->state) % stress_params.total_weight;
+		stress_op_t op = STRESS_PWNAM;
+		while (pick >= stress_params.weights[op]) {
+			pick -= stress_params.weights[op];
+			++op;
+		}
+		stress_call(worker, op);
+	}
+
+	return NULL;
+}
+
+static void stress_child(unsigned int threads, int fd) {
+	stress_worker_t* workers = calloc(threads, sizeof(stress_worker_t));
+	if (workers == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	const uint64_t started = stress_now();
+	for (unsigned int i = 0; i < threads; ++i) {
+		workers[i].state = 88172645463325252ull + i * 0x9e3779b97f4a7c15ull;
+		workers[i].buffer = malloc(STRESS_BUFLEN);
+		if (workers[i].buffer == NULL || pthread_create(&workers[i].thread, NULL, stress_work, &workers[i]) != 0) {
+			fprintf(stderr, "Cannot start thread %u\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	sleep(stress_params.seconds);
+	atomic_store(&stress_stop, true);
+
+	stress_result_t total;
+	memset(&total, 0, sizeof(total));
+	for (unsigned int i = 0; i < threads; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		for (int op = 0; op < STRESS_OPS; ++op) {
+			total.calls[op] += workers[i].result.calls[op];
+		}
+		total.failures += workers[i].result.failures;
+		total.mismatches += workers[i].result.mismatches;
+		free(workers[i].buffer);
+	}
+	total.nanoseconds = stress_now() - started;
+	free(workers);
+
+	if (write(fd, &total, sizeof(total)) != sizeof(total)) {
+		exit(EXIT_FAILURE);
+	}
+	/* exit() rather than _exit(), so that sanitizers get to report */
+	exit(EXIT_SUCCESS);
+}
+
+static bool stress_run(unsigned int threads, stress_result_t* result, int* wstatus) {
+	/* every run is a separate process, so that a crash is reported instead of ending the whole harness */
+	int fds[2];
+	if (pipe(fds) == -1) {
+		fprintf(stderr, "Cannot create pipe: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == -1) {
+		fprintf(stderr, "Cannot fork: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	} else if (pid == 0) {
+		close(fds[0]);
+		stress_child(threads, fds[1]);
+	}
+
+	close(fds[1]);
+	const bool received = read(fds[0], result, sizeof(stress_result_t)) == sizeof(stress_result_t);
+	close(fds[0]);
+	waitpid(pid, wstatus, 0);
+
+	return received;
+}
+
+static void stress_mix_parse(char* mix) {
+	memset(stress_params.weights, 0, sizeof(stress_params.weights));
+	char* save = NULL;
+	for (char* item = strtok_r(mix, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+		char* value = strchr(item, '=');
+		int op = 0;
+		while (value != NULL && op < STRESS_OPS && (strlen(stress_op_names[op]) != (size_t)(value - item) || strncmp(item, stress_op_names[op], value - item) != 0)) {
+			++op;
+		}
+		if (value == NULL || op == STRESS_OPS) {
+			fprintf(stderr, "Invalid mix entry %s, expected <pw|sp|gr|gid|ent>=<weight>\n", item);
+			exit(EXIT_FAILURE);
+		}
+		stress_params.weights[op] = strtoul(value + 1, NULL, 10);
+	}
+}
+
+static size_t stress_threads_parse(char* list, unsigned int* threads) {
+	size_t count = 0;
+	char* save = NULL;
+	for (char* item = strtok_r(list, ",", &save); item != NULL && count < STRESS_MAX_THREADS; item = strtok_r(NULL, ",", &save)) {
+		const unsigned long n = strtoul(item, NULL, 10);
+		if (n == 0 || n > STRESS_MAX_THREADS) {
+			fprintf(stderr, "Invalid thread count %s\n", item);
+			exit(EXIT_FAILURE);
+		}
+		threads[count++] = n;
+	}
+
+	return count;
+}
+
+int main(int argc, char* argv[]) {
+	const char* library = "./libnss_mtl_stress.so";
+	char default_mix[] = "pw=40,sp=10,gr=20,gid=20,ent=10";
+	char* mix = default_mix;
+	char* thread_list = NULL;
+	stress_params.seconds = 2;
+	stress_params.users = 10000;
+
+	int opt = 0;
+	while ((opt = getopt(argc, argv, "l:t:d:m:u:")) != -1) {
+		switch (opt) {
+		case 'l':
+			library = optarg;
+			break;
+		case 't':
+			thread_list = optarg;
+			break;
+		case 'd':
+			stress_params.seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			mix = optarg;
+			break;
+		case 'u':
+			stress_params.users = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-l <library>] [-t <threads,...>] [-d <seconds>] [-m <op=weight,...>] [-u <users>]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	stress_mix_parse(mix);
+	stress_params.total_weight = 0;
+	for (int op = 0; op < STRESS_OPS; ++op) {
+		stress_params.total_weight += stress_params.weights[op];
+	}
+	if (stress_params.total_weight == 0 || stress_params.users == 0 || stress_params.seconds == 0) {
+		fprintf(stderr, "Mix, number of users and duration must not be empty\n");
+		return EXIT_FAILURE;
+	}
+
+	/* by default thread count doubles up to the number of cpus */
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int threads[STRESS_MAX_THREADS];
+	size_t runs = 0;
+	if (thread_list != NULL) {
+		runs = stress_threads_parse(thread_list, threads);
+	} else {
+		for (unsigned int n = 1; n < cpus && n < STRESS_MAX_THREADS; n *= 2) {
+			threads[runs++] = n;
+		}
+		threads[runs++] = cpus > 0 && cpus < STRESS_MAX_THREADS ? cpus : 1;
+	}
+
+	stress_load(library);
+	stress_groups_read();
+
+	printf("# library=%s cpus=%ld seconds=%u groups=%zu users=%zu mix=", library, cpus, stress_params.seconds, stress_groups.count, stress_params.users);
+	for (int op = 0; op < STRESS_OPS; ++op) {
+		printf("%s%s=%u", op > 0 ? "," : "", stress_op_names[op], stress_params.weights[op]);
+	}
+	printf("\n# threads\tcalls\tops_per_sec\tspeedup\tefficiency\tfailures\tmismatches\tstatus\n");
+
+	bool failed = false;
+	double base = 0.0;
+	for (size_t i = 0; i < runs; ++i) {
+		stress_result_t result;
+		memset(&result, 0, sizeof(result));
+		int wstatus = 0;
+		const bool received = stress_run(threads[i], &result, &wstatus);
+
+		char status[32] = "ok";
+		if (WIFSIGNALED(wstatus)) {
+			snprintf(status, sizeof(status), "signal %d", WTERMSIG(wstatus));
+		} else if (! WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+			snprintf(status, sizeof(status), "exit %d", WEXITSTATUS(wstatus));
+		} else if (! received) {
+			snprintf(status, sizeof(status), "no result");
+		}
+
+		uint64_t calls = 0;
+		for (int op = 0; op < STRESS_OPS; ++op) {
+			calls += result.calls[op];
+		}
+		const double rate = result.nanoseconds > 0 ? calls * 1e9 / result.nanoseconds : 0.0;
+		if (base == 0.0) {
+			base = rate / threads[i];
+		}
+		const double speedup = base > 0.0 ? rate / base : 0.0;
+		printf("%u\t%lu\t%.0f\t%.2f\t%.2f\t%lu\t%lu\t%s\n", threads[i], (unsigned long)calls, rate, speedup, speedup / threads[i],
+			(unsigned long)result.failures, (unsigned long)result.mismatches, status);
+
+		failed = failed || strcmp(status, "ok") != 0 || result.failures > 0 || result.mismatches > 0;
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
\ No newline at end of file
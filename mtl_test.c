@@ -14,15 +14,46 @@ static void print_list(nss_mtl_utils_list_t* lst) {
 	printf("\n");
 }
 
+static void print_set(nss_mtl_utils_set_t* set) {
+	size_t printed = 0;
+	for (size_t i = 0; i <= set->mask; ++i) {
+		if (set->slots[i].item != NULL) {
+			printf(" %s%s", set->slots[i].item, (++printed >= set->count) ? "" : ",");
+		}
+	}
+	printf("\n");
+}
+
+static void print_map(nss_mtl_config_names_t* map, size_t target) {
+	nss_mtl_utils_set_t* sets[] = { map->names, map->globs };
+	for (size_t k = 0; k < 2; ++k) {
+		for (size_t i = 0; i <= sets[k]->mask; ++i) {
+			if (sets[k]->slots[i].item != NULL && sets[k]->slots[i].value == target) {
+				printf(" %s", sets[k]->slots[i].item);
+			}
+		}
+	}
+	printf("\n");
+}
+
 static void print_config(nss_mtl_config_t* config) {
 	assert(config != NULL);
 	printf("Configuration:\n");
 	printf("log_level = %d\n", config->log_level);
+	printf("log_rate_limit = %u\n", config->log_rate_limit);
 	printf("target_user = %s\n", config->target_user);
+	for (size_t target = 0; target < config->targets_count; ++target) {
+		printf("map %s =", config->targets[target]);
+		print_map(&config->map, target);
+	}
 	printf("ignored_users =");
-	print_list(config->ignored_users);
+	print_set(config->ignored_users.names);
+	printf("ignored_users patterns =");
+	print_set(config->ignored_users.globs);
 	printf("ignored_execs =");
-	print_list(config->ignored_execs);
+	print_set(config->ignored_execs.names);
+	printf("ignored_execs patterns =");
+	print_set(config->ignored_execs.globs);
 }
 
 int main(int argc, char* argv[]) {
@@ -49,10 +80,15 @@ int main(int argc, char* argv[]) {
 	}
 
 
-	nss_mtl_utils_list_t* users = nss_mtl_utils_users_get();
+	nss_mtl_arena_t* arena = nss_mtl_arena_create(BUFSIZ);
+	nss_mtl_utils_list_t* users = arena != NULL ? nss_mtl_utils_users_get(arena) : NULL;
 	printf("Logged in users =");
-	print_list(users);
-	nss_mtl_utils_list_free(users);
+	if (users != NULL) {
+		print_list(users);
+	} else {
+		printf("\n");
+	}
+	nss_mtl_arena_destroy(arena);
 
 	if (conf != NULL) {
 		nss_mtl_config_t* config = nss_mtl_config_parse(conf);
@@ -0,0 +1,392 @@
+/*
+ * nss_mtld.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "src/lookup.h"
+#include "src/protocol.h"
+#include "src/utils.h"
+
+/*
+ * How long a single request may take, in milliseconds, however slowly its
+ * client sends it. Well below client side timeout, so that a client queued
+ * behind stalled ones is still served.
+ */
+#define NSS_MTLD_CLIENT_TIMEOUT 250
+/* clients served at once, a client which never sends its request holds up only one of them */
+#define NSS_MTLD_WORKERS 16
+/* accepted connections waiting for a worker, ones beyond it wait in listen backlog */
+#define NSS_MTLD_QUEUE_SIZE 256
+#define NSS_MTLD_INITGROUPS_SIZE 16
+
+/* accepted connections handed over from main thread to workers */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_cond_t space;
+	int fds[NSS_MTLD_QUEUE_SIZE];
+	size_t head;
+	size_t count;
+	bool closed;
+} nss_mtld_queue_t;
+
+static volatile sig_atomic_t nss_mtld_running = 1;
+static nss_mtld_queue_t nss_mtld_queue = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.ready = PTHREAD_COND_INITIALIZER,
+	.space = PTHREAD_COND_INITIALIZER,
+};
+
+static void nss_mtld_stop(int sig) {
+	(void)sig;
+	nss_mtld_running = 0;
+}
+
+static bool nss_mtld_read_string(int fd, uint32_t length, char* str, uint64_t deadline) {
+	if (length > NSS_MTL_PROTOCOL_MAX_STRING || ! nss_mtl_protocol_recv(fd, str, length, deadline)) {
+		return false;
+	}
+	str[length] = '\0';
+
+	return true;
+}
+
+static bool nss_mtld_reply(int fd, enum nss_status status, int errnop, const char* payload, size_t length, uint64_t deadline) {
+	const nss_mtl_response_t response = {
+		.status = status,
+		.errnop = status == NSS_STATUS_SUCCESS ? 0 : errnop,
+		.length = status == NSS_STATUS_SUCCESS ? length : 0,
+	};
+
+	return nss_mtl_protocol_send(fd, &response, sizeof(response), deadline)
+		&& (response.length == 0 || nss_mtl_protocol_send(fd, payload, response.length, deadline));
+}
+
+static bool nss_mtld_initgroups(int fd, const nss_mtl_caller_t* caller, const char* user, gid_t group, uint64_t deadline) {
+	long int start = 0;
+	long int size = NSS_MTLD_INITGROUPS_SIZE;
+	int errnop = 0;
+
+	gid_t* groups = malloc(size * sizeof(gid_t));
+	if (groups == NULL) {
+		return nss_mtld_reply(fd, NSS_STATUS_TRYAGAIN, ENOMEM, NULL, 0, deadline);
+	}
+
+	enum nss_status status = nss_mtl_lookup_initgroups(caller, user, group, &start, &size, &groups, 0, &errnop);
+	if (status != NSS_STATUS_SUCCESS) {
+		free(groups);
+		return nss_mtld_reply(fd, status, errnop, NULL, 0, deadline);
+	}
+
+	const nss_mtl_reply_groups_t reply = { .count = start };
+	const size_t length = sizeof(reply) + start * sizeof(gid_t);
+	char* payload = malloc(length);
+	if (payload == NULL) {
+		free(groups);
+		return nss_mtld_reply(fd, NSS_STATUS_TRYAGAIN, ENOMEM, NULL, 0, deadline);
+	}
+	memcpy(payload, &reply, sizeof(reply));
+	memcpy(payload + sizeof(reply), groups, start * sizeof(gid_t));
+	free(groups);
+
+	bool sent = nss_mtld_reply(fd, status, errnop, payload, length, deadline);
+	free(payload);
+	return sent;
+}
+
+static bool nss_mtld_serve(int fd) {
+	const uint64_t deadline = nss_mtl_protocol_deadline(NSS_MTLD_CLIENT_TIMEOUT);
+
+	/*
+	 * Exec name and session user come from the peer, which could claim the same
+	 * running the lookup in-process, so they are only logged along with its
+	 * credentials, not checked.
+	 */
+	struct ucred peer;
+	socklen_t peer_length = sizeof(peer);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_length) == -1) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: cannot get peer credentials: %m", __func__);
+		return false;
+	}
+
+	nss_mtl_request_t request;
+	if (! nss_mtl_protocol_recv(fd, &request, sizeof(request), deadline)) {
+		return false;
+	}
+	if (request.version != NSS_MTL_PROTOCOL_VERSION || request.buflen > NSS_MTL_PROTOCOL_MAX_BUFFER) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: malformed request of version %u from pid %d uid %u", __func__, request.version, peer.pid, peer.uid);
+		return false;
+	}
+
+	char key[NSS_MTL_PROTOCOL_MAX_STRING + 1];
+	char exec[NSS_MTL_PROTOCOL_MAX_STRING + 1];
+	char session_user[NSS_MTL_PROTOCOL_MAX_STRING + 1];
+	if (! nss_mtld_read_string(fd, request.key_length, key, deadline)
+		|| ! nss_mtld_read_string(fd, request.exec_length, exec, deadline)
+		|| ! nss_mtld_read_string(fd, request.session_length, session_user, deadline)) {
+		return false;
+	}
+	const nss_mtl_caller_t caller = { exec, session_user, true };
+	nss_mtl_utils_log(LOG_DEBUG, "%s: request %u for %s from pid %d uid %u exec %s session user %s", __func__, request.type, key, peer.pid, peer.uid, exec, session_user);
+
+	if (request.type == NSS_MTL_REQUEST_INITGROUPS) {
+		return nss_mtld_initgroups(fd, &caller, key, request.gid, deadline);
+	}
+
+	char* buffer = malloc(request.buflen + 1);
+	if (buffer == NULL) {
+		return nss_mtld_reply(fd, NSS_STATUS_TRYAGAIN, ENOMEM, NULL, 0, deadline);
+	}
+
+	enum nss_status status = NSS_STATUS_UNAVAIL;
+	int errnop = 0;
+	char* payload = NULL;
+	size_t length = 0;
+	switch (request.type) {
+	case NSS_MTL_REQUEST_PWNAM: {
+		struct passwd pw;
+		status = nss_mtl_lookup_pwnam(&caller, key, &pw, buffer, request.buflen, &errnop);
+		if (status == NSS_STATUS_SUCCESS) {
+			length = nss_mtl_protocol_passwd_pack(&pw, buffer, request.buflen, &payload);
+		}
+		break;
+	}
+	case NSS_MTL_REQUEST_SPNAM: {
+		struct spwd spw;
+		status = nss_mtl_lookup_spnam(&caller, key, &spw, buffer, request.buflen, &errnop);
+		if (status == NSS_STATUS_SUCCESS) {
+			length = nss_mtl_protocol_spwd_pack(&spw, buffer, request.buflen, &payload);
+		}
+		break;
+	}
+	case NSS_MTL_REQUEST_GRNAM:
+	case NSS_MTL_REQUEST_GRGID: {
+		struct group grp;
+		if (request.type == NSS_MTL_REQUEST_GRNAM) {
+			status = nss_mtl_lookup_grnam(&caller, key, &grp, buffer, request.buflen, &errnop);
+		} else {
+			status = nss_mtl_lookup_grgid(&caller, request.gid, &grp, buffer, request.buflen, &errnop);
+		}
+		if (status == NSS_STATUS_SUCCESS) {
+			length = nss_mtl_protocol_group_pack(&grp, buffer, request.buflen, &payload);
+		}
+		break;
+	}
+	default:
+		nss_mtl_utils_log(LOG_WARNING, "%s: unknown request type %u from pid %d uid %u", __func__, request.type, peer.pid, peer.uid);
+		free(buffer);
+		return false;
+	}
+	free(buffer);
+
+	if (status == NSS_STATUS_SUCCESS && length == 0) {
+		/* let client resolve the query on its own */
+		return false;
+	}
+
+	bool sent = nss_mtld_reply(fd, status, errnop, payload, length, deadline);
+	free(payload);
+	return sent;
+}
+
+static void nss_mtld_enqueue(int fd) {
+	pthread_mutex_lock(&nss_mtld_queue.lock);
+	/* every request ends by its deadline, so a worker frees up soon */
+	while (nss_mtld_queue.count == NSS_MTLD_QUEUE_SIZE) {
+		pthread_cond_wait(&nss_mtld_queue.space, &nss_mtld_queue.lock);
+	}
+	nss_mtld_queue.fds[(nss_mtld_queue.head + nss_mtld_queue.count) % NSS_MTLD_QUEUE_SIZE] = fd;
+	++nss_mtld_queue.count;
+	pthread_cond_signal(&nss_mtld_queue.ready);
+	pthread_mutex_unlock(&nss_mtld_queue.lock);
+}
+
+static int nss_mtld_dequeue(void) {
+	pthread_mutex_lock(&nss_mtld_queue.lock);
+	while (nss_mtld_queue.count == 0 && ! nss_mtld_queue.closed) {
+		pthread_cond_wait(&nss_mtld_queue.ready, &nss_mtld_queue.lock);
+	}
+	int fd = -1;
+	if (nss_mtld_queue.count > 0) {
+		fd = nss_mtld_queue.fds[nss_mtld_queue.head];
+		nss_mtld_queue.head = (nss_mtld_queue.head + 1) % NSS_MTLD_QUEUE_SIZE;
+		--nss_mtld_queue.count;
+		pthread_cond_signal(&nss_mtld_queue.space);
+	}
+	pthread_mutex_unlock(&nss_mtld_queue.lock);
+
+	return fd;
+}
+
+static void nss_mtld_queue_close(void) {
+	pthread_mutex_lock(&nss_mtld_queue.lock);
+	nss_mtld_queue.closed = true;
+	pthread_cond_broadcast(&nss_mtld_queue.ready);
+	pthread_mutex_unlock(&nss_mtld_queue.lock);
+}
+
+static void* nss_mtld_worker(void* arg) {
+	(void)arg;
+	int fd = -1;
+	/* connections still queued at shutdown are served too, their clients are waiting already */
+	while ((fd = nss_mtld_dequeue()) != -1) {
+		nss_mtld_serve(fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+static int nss_mtld_listen(const char* path) {
+	char* dir = strdup(path);
+	if (dir == NULL) {
+		return -1;
+	}
+	if (mkdir(dirname(dir), 0755) == -1 && errno != EEXIST) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot create directory for %s: %m", __func__, path);
+		free(dir);
+		return -1;
+	}
+	free(dir);
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		nss_mtl_utils_log(LOG_ERR, "%s: socket path %s is too long", __func__, path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot create socket: %m", __func__);
+		return -1;
+	}
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || chmod(path, 0666) == -1 || listen(fd, SOMAXCONN) == -1) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot listen on %s: %m", __func__, path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int main(int argc, char* argv[]) {
+	const char* path = NSS_MTL_SOCKET_FILE;
+	bool foreground = false;
+
+	int opt = 0;
+	while ((opt = getopt(argc, argv, "s:f")) != -1) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		case 'f':
+			foreground = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-f] [-s <socket_file>]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	openlog("nss_mtld", LOG_PID | (foreground ? LOG_PERROR : 0), LOG_DAEMON);
+
+	int listen_fd = nss_mtld_listen(path);
+	if (listen_fd == -1) {
+		return EXIT_FAILURE;
+	}
+
+	if (! foreground && daemon(0, 0) == -1) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot daemonize: %m", __func__);
+		close(listen_fd);
+		unlink(path);
+		return EXIT_FAILURE;
+	}
+
+	/* no SA_RESTART, so that accept() returns on signal */
+	struct sigaction sa = { .sa_handler = nss_mtld_stop };
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* signals are handled by the main thread only, so that accept() is the call they interrupt */
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+
+	pthread_t workers[NSS_MTLD_WORKERS];
+	size_t started = 0;
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	for (; started < NSS_MTLD_WORKERS; ++started) {
+		const int err = pthread_create(&workers[started], NULL, nss_mtld_worker, NULL);
+		if (err != 0) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot start worker thread: %s", __func__, strerror(err));
+			break;
+		}
+	}
+	pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+	if (started == 0) {
+		close(listen_fd);
+		unlink(path);
+		return EXIT_FAILURE;
+	}
+
+	nss_mtl_utils_log(LOG_INFO, "%s: listening on %s", __func__, path);
+
+	while (nss_mtld_running) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno != EINTR) {
+				nss_mtl_utils_log(LOG_WARNING, "%s: accept failed: %m", __func__);
+			}
+			continue;
+		}
+
+		nss_mtld_enqueue(fd);
+	}
+
+	nss_mtl_utils_log(LOG_INFO, "%s: shutting down", __func__);
+	close(listen_fd);
+	unlink(path);
+
+	nss_mtld_queue_close();
+	for (size_t i = 0; i < started; ++i) {
+		pthread_join(workers[i], NULL);
+	}
+
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#define PAM_SM_SESSION
+#include <security/pam_modules.h>
+
+#include "src/passwd.h"
+#include "src/registry.h"
+#include "src/utils.h"
+
+/*
+ * Registers sessions of non-local users in NSS_MTL_REGISTRY_FILE, so that
+ * group lookups of every process see them without reading utmp. Failures
+ * are only logged, a login is never refused because of the registry.
+ */
+static void pam_mtl_update(pam_handle_t* pamh, bool open) {
+	const char* user = NULL;
+	if (pam_get_user(pamh, &user, NULL) != PAM_SUCCESS || user == NULL || user[0] == '\0') {
+		return;
+	}
+
+	const nss_mtl_passwd_t* local = nss_mtl_passwd_acquire();
+	if (local == NULL) {
+		return;
+	}
+	const bool is_local = nss_mtl_passwd_contains(local, user);
+	nss_mtl_passwd_release(local);
+	if (is_local) {
+		return;
+	}
+
+	nss_mtl_registry_t* registry = nss_mtl_registry_map(NSS_MTL_REGISTRY_FILE, true);
+	if (registry == NULL) {
+		return;
+	}
+	/* session is closed by the same process which opened it */
+	if (open) {
+		nss_mtl_registry_add(registry, user, getpid());
+	} else {
+		nss_mtl_registry_remove(registry, user, getpid());
+	}
+	nss_mtl_registry_unmap(registry);
+}
+
+PAM_EXTERN int pam_sm_open_session(pam_handle_t* pamh, int flags, int argc, const char** argv) {
+	(void)flags;
+	(void)argc;
+	(void)argv;
+
+	pam_mtl_update(pamh, true);
+	return PAM_SUCCESS;
+}
+
+PAM_EXTERN int pam_sm_close_session(pam_handle_t* pamh, int flags, int argc, const char** argv) {
+	(void)flags;
+	(void)argc;
+	(void)argv;
+
+	pam_mtl_update(pamh, false);
+	return PAM_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+/*
+ * arena.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <syslog.h>
+
+#include "arena.h"
+#include "utils.h"
+
+#define NSS_MTL_ARENA_MIN_SIZE 256
+
+static nss_mtl_arena_t* nss_mtl_arena_chunk_alloc(size_t size);
+static void* nss_mtl_arena_take(nss_mtl_arena_t* arena, size_t size, size_t align);
+
+/* implementation */
+
+nss_mtl_arena_t* nss_mtl_arena_chunk_alloc(size_t size) {
+	if (size < NSS_MTL_ARENA_MIN_SIZE) {
+		size = NSS_MTL_ARENA_MIN_SIZE;
+	}
+	nss_mtl_arena_t* chunk = size <= SIZE_MAX - sizeof(nss_mtl_arena_t) ? malloc(sizeof(nss_mtl_arena_t) + size) : NULL;
+	if (chunk == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate arena chunk of size %lu", __func__, size);
+		return NULL;
+	}
+	chunk->next = NULL;
+	chunk->current = chunk;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+nss_mtl_arena_t* nss_mtl_arena_create(size_t size) {
+	return nss_mtl_arena_chunk_alloc(size);
+}
+
+void nss_mtl_arena_destroy(nss_mtl_arena_t* arena) {
+	while (arena != NULL) {
+		nss_mtl_arena_t* next = arena->next;
+		free(arena);
+		arena = next;
+	}
+}
+
+void* nss_mtl_arena_take(nss_mtl_arena_t* arena, size_t size, size_t align) {
+	assert(arena != NULL);
+
+	nss_mtl_arena_t* chunk = arena->current;
+	size_t start = (chunk->used + align - 1) & ~(align - 1);
+	if (start > chunk->size || chunk->size - start < size) {
+		/* chunks at least double, so that a badly sized arena still needs few of them */
+		if (size > SIZE_MAX / 2 - align) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate %lu bytes from arena", __func__, size);
+			return NULL;
+		}
+		const size_t needed = size + align;
+		nss_mtl_arena_t* grown = nss_mtl_arena_chunk_alloc(needed > 2 * chunk->size ? needed : 2 * chunk->size);
+		if (grown == NULL) {
+			return NULL;
+		}
+		nss_mtl_utils_log(LOG_DEBUG, "%s: arena of %lu bytes exhausted, added chunk of %lu bytes", __func__, arena->size, grown->size);
+		grown->next = arena->next;
+		arena->next = grown;
+		arena->current = grown;
+		chunk = grown;
+		start = 0;
+	}
+
+	chunk->used = start + size;
+	return (char*)chunk->data + start;
+}
+
+void* nss_mtl_arena_alloc(nss_mtl_arena_t* arena, size_t size) {
+	return nss_mtl_arena_take(arena, size, _Alignof(max_align_t));
+}
+
+void* nss_mtl_arena_calloc(nss_mtl_arena_t* arena, size_t nmemb, size_t size) {
+	if (size != 0 && nmemb > SIZE_MAX / size) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate %lu items of size %lu from arena", __func__, nmemb, size);
+		return NULL;
+	}
+
+	void* ptr = nss_mtl_arena_alloc(arena, nmemb * size);
+	if (ptr != NULL) {
+		memset(ptr, 0, nmemb * size);
+	}
+	return ptr;
+}
+
+char* nss_mtl_arena_strndup(nss_mtl_arena_t* arena, const char* str, size_t len) {
+	/* strings need no alignment, so that they pack tightly */
+	char* copy = nss_mtl_arena_take(arena, len + 1, 1);
+	if (copy != NULL) {
+		memcpy(copy, str, len);
+		copy[len] = '\0';
+	}
+	return copy;
+}
+
+size_t nss_mtl_arena_used(const nss_mtl_arena_t* arena) {
+	size_t used = 0;
+	for (; arena != NULL; arena = arena->next) {
+		used += arena->used;
+	}
+	return used;
+}
\ No newline at end of file
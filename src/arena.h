@@ -0,0 +1,55 @@
+/*
+ * arena.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_ARENA_H
+#define NSS_MTL_ARENA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bump allocator owning everything of a single snapshot, so that building
+ * it takes one malloc() in the common case and dropping it one free().
+ * Requests not fitting in the first chunk get chained ones of growing size.
+ */
+typedef struct nss_mtl_arena {
+	struct nss_mtl_arena* next;
+	/* chunk allocations are taken from, only kept up to date in the first one */
+	struct nss_mtl_arena* current;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+} nss_mtl_arena_t;
+
+nss_mtl_arena_t* nss_mtl_arena_create(size_t size);
+void nss_mtl_arena_destroy(nss_mtl_arena_t* arena);
+void* nss_mtl_arena_alloc(nss_mtl_arena_t* arena, size_t size);
+void* nss_mtl_arena_calloc(nss_mtl_arena_t* arena, size_t nmemb, size_t size);
+char* nss_mtl_arena_strndup(nss_mtl_arena_t* arena, const char* str, size_t len);
+/* bytes taken from all chunks, a good size for the next arena built the same way */
+size_t nss_mtl_arena_used(const nss_mtl_arena_t* arena);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_ARENA_H */
\ No newline at end of file
@@ -0,0 +1,251 @@
+/*
+ * client.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "client.h"
+#include "protocol.h"
+#include "stats.h"
+#include "utils.h"
+
+/* how long to wait for nss_mtld to answer */
+#define NSS_MTL_CLIENT_TIMEOUT 1
+/* how long to skip nss_mtld after it was found missing */
+#define NSS_MTL_CLIENT_RETRY_INTERVAL 5
+
+static long nss_mtl_client_now(void);
+static int nss_mtl_client_connect(void);
+static bool nss_mtl_client_query(const nss_mtl_caller_t* caller, uint32_t type, const char* key, gid_t gid, size_t buflen, nss_mtl_response_t* response, char** payload);
+static void nss_mtl_client_failed(int fd);
+static bool nss_mtl_client_result(const nss_mtl_response_t* response, size_t buflen, int* errnop, enum nss_status* status);
+
+static atomic_long nss_mtl_client_retry_at = 0;
+
+/* implementation */
+
+long nss_mtl_client_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec;
+}
+
+int nss_mtl_client_connect(void) {
+	if (nss_mtl_client_now() < atomic_load_explicit(&nss_mtl_client_retry_at, memory_order_relaxed)) {
+		return -1;
+	}
+
+	/* exchange waits in poll() with its own deadline, so the socket never blocks */
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd == -1) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: cannot create socket: %m", __func__);
+		return -1;
+	}
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	strncpy(addr.sun_path, NSS_MTL_SOCKET_FILE, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+		if (errno == EAGAIN) {
+			/* listen backlog is full, daemon is busy rather than gone */
+			nss_mtl_utils_log(LOG_DEBUG, "%s: nss_mtld at %s is busy", __func__, NSS_MTL_SOCKET_FILE);
+			close(fd);
+			return -1;
+		}
+		nss_mtl_utils_log(LOG_DEBUG, "%s: nss_mtld not available at %s: %m", __func__, NSS_MTL_SOCKET_FILE);
+		nss_mtl_client_failed(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+void nss_mtl_client_failed(int fd) {
+	/* daemon is optional, so neither a missing nor a stuck one is waited for on every query */
+	atomic_store_explicit(&nss_mtl_client_retry_at, nss_mtl_client_now() + NSS_MTL_CLIENT_RETRY_INTERVAL, memory_order_relaxed);
+	close(fd);
+}
+
+bool nss_mtl_client_query(const nss_mtl_caller_t* caller, uint32_t type, const char* key, gid_t gid, size_t buflen, nss_mtl_response_t* response, char** payload) {
+	const char* exec = caller->exec != NULL ? caller->exec : "";
+	const char* session_user = caller->session_user != NULL ? caller->session_user : "";
+
+	const nss_mtl_request_t request = {
+		.version = NSS_MTL_PROTOCOL_VERSION,
+		.type = type,
+		.gid = gid,
+		.buflen = buflen > NSS_MTL_PROTOCOL_MAX_BUFFER ? NSS_MTL_PROTOCOL_MAX_BUFFER : buflen,
+		.key_length = strnlen(key, NSS_MTL_PROTOCOL_MAX_STRING + 1),
+		.exec_length = strnlen(exec, NSS_MTL_PROTOCOL_MAX_STRING + 1),
+		.session_length = strnlen(session_user, NSS_MTL_PROTOCOL_MAX_STRING + 1),
+	};
+	if (request.key_length > NSS_MTL_PROTOCOL_MAX_STRING || request.exec_length > NSS_MTL_PROTOCOL_MAX_STRING || request.session_length > NSS_MTL_PROTOCOL_MAX_STRING) {
+		return false;
+	}
+
+	int fd = nss_mtl_client_connect();
+	if (fd == -1) {
+		return false;
+	}
+	const uint64_t started = nss_mtl_stats_begin();
+
+	const uint64_t deadline = nss_mtl_protocol_deadline(NSS_MTL_CLIENT_TIMEOUT * 1000);
+
+	*payload = NULL;
+	if (! nss_mtl_protocol_send(fd, &request, sizeof(request), deadline)
+		|| ! nss_mtl_protocol_send(fd, key, request.key_length, deadline)
+		|| ! nss_mtl_protocol_send(fd, exec, request.exec_length, deadline)
+		|| ! nss_mtl_protocol_send(fd, session_user, request.session_length, deadline)
+		|| ! nss_mtl_protocol_recv(fd, response, sizeof(nss_mtl_response_t), deadline)) {
+		nss_mtl_utils_log_limited(NSS_MTL_UTILS_LOG_DAEMON, LOG_WARNING, "%s: failed to query nss_mtld: %m", __func__);
+		nss_mtl_client_failed(fd);
+		return false;
+	}
+
+	if (response->length > 0) {
+		*payload = response->length <= 2 * NSS_MTL_PROTOCOL_MAX_BUFFER ? malloc(response->length) : NULL;
+		if (*payload == NULL || ! nss_mtl_protocol_recv(fd, *payload, response->length, deadline)) {
+			nss_mtl_utils_log_limited(NSS_MTL_UTILS_LOG_DAEMON, LOG_WARNING, "%s: failed to read nss_mtld response of size %u", __func__, response->length);
+			free(*payload);
+			*payload = NULL;
+			nss_mtl_client_failed(fd);
+			return false;
+		}
+	}
+
+	close(fd);
+	nss_mtl_stats_record(NSS_MTL_STATS_DAEMON, started, nss_mtl_stats_result(response->status, response->errnop), sizeof(request) + response->length);
+	return true;
+}
+
+bool nss_mtl_client_result(const nss_mtl_response_t* response, size_t buflen, int* errnop, enum nss_status* status) {
+	if (response->status == NSS_STATUS_TRYAGAIN && response->errnop == ERANGE && buflen > NSS_MTL_PROTOCOL_MAX_BUFFER) {
+		/* daemon worked with smaller buffer than the caller has */
+		return false;
+	}
+
+	*status = response->status;
+	if (response->status != NSS_STATUS_SUCCESS) {
+		*errnop = response->errnop;
+	}
+
+	return true;
+}
+
+bool nss_mtl_client_pwnam(const nss_mtl_caller_t* caller, const char* name, struct passwd* pw, char* buffer, size_t buflen, int* errnop, enum nss_status* status) {
+	nss_mtl_response_t response;
+	char* payload = NULL;
+	if (! nss_mtl_client_query(caller, NSS_MTL_REQUEST_PWNAM, name, 0, buflen, &response, &payload)) {
+		return false;
+	}
+
+	const bool handled = nss_mtl_client_result(&response, buflen, errnop, status)
+		&& (response.status != NSS_STATUS_SUCCESS || nss_mtl_protocol_passwd_unpack(payload, response.length, pw, buffer, buflen));
+
+	free(payload);
+	return handled;
+}
+
+bool nss_mtl_client_spnam(const nss_mtl_caller_t* caller, const char* name, struct spwd* spw, char* buffer, size_t buflen, int* errnop, enum nss_status* status) {
+	nss_mtl_response_t response;
+	char* payload = NULL;
+	if (! nss_mtl_client_query(caller, NSS_MTL_REQUEST_SPNAM, name, 0, buflen, &response, &payload)) {
+		return false;
+	}
+
+	const bool handled = nss_mtl_client_result(&response, buflen, errnop, status)
+		&& (response.status != NSS_STATUS_SUCCESS || nss_mtl_protocol_spwd_unpack(payload, response.length, spw, buffer, buflen));
+
+	free(payload);
+	return handled;
+}
+
+bool nss_mtl_client_grnam(const nss_mtl_caller_t* caller, const char* name, struct group* grp, char* buffer, size_t buflen, int* errnop, enum nss_status* status) {
+	nss_mtl_response_t response;
+	char* payload = NULL;
+	if (! nss_mtl_client_query(caller, NSS_MTL_REQUEST_GRNAM, name, 0, buflen, &response, &payload)) {
+		return false;
+	}
+
+	const bool handled = nss_mtl_client_result(&response, buflen, errnop, status)
+		&& (response.status != NSS_STATUS_SUCCESS || nss_mtl_protocol_group_unpack(payload, response.length, grp, buffer, buflen));
+
+	free(payload);
+	return handled;
+}
+
+bool nss_mtl_client_grgid(const nss_mtl_caller_t* caller, gid_t gid, struct group* grp, char* buffer, size_t buflen, int* errnop, enum nss_status* status) {
+	nss_mtl_response_t response;
+	char* payload = NULL;
+	if (! nss_mtl_client_query(caller, NSS_MTL_REQUEST_GRGID, "", gid, buflen, &response, &payload)) {
+		return false;
+	}
+
+	const bool handled = nss_mtl_client_result(&response, buflen, errnop, status)
+		&& (response.status != NSS_STATUS_SUCCESS || nss_mtl_protocol_group_unpack(payload, response.length, grp, buffer, buflen));
+
+	free(payload);
+	return handled;
+}
+
+bool nss_mtl_client_initgroups(const nss_mtl_caller_t* caller, const char* user, gid_t group, long int* start, long int* size, gid_t** groupsp, long int limit, int* errnop, enum nss_status* status) {
+	nss_mtl_response_t response;
+	char* payload = NULL;
+	if (! nss_mtl_client_query(caller, NSS_MTL_REQUEST_INITGROUPS, user, group, 0, &response, &payload)) {
+		return false;
+	}
+
+	if (response.status != NSS_STATUS_SUCCESS) {
+		free(payload);
+		*status = response.status;
+		*errnop = response.errnop;
+		return true;
+	}
+
+	nss_mtl_reply_groups_t reply;
+	if (response.length < sizeof(reply)) {
+		free(payload);
+		return false;
+	}
+	memcpy(&reply, payload, sizeof(reply));
+	if (response.length != sizeof(reply) + (size_t)reply.count * sizeof(gid_t)) {
+		free(payload);
+		return false;
+	}
+
+	gid_t* gids = malloc((reply.count + 1) * sizeof(gid_t));
+	if (gids == NULL) {
+		free(payload);
+		return false;
+	}
+	memcpy(gids, payload + sizeof(reply), reply.count * sizeof(gid_t));
+	*status = nss_mtl_lookup_groups_add(gids, reply.count, group, start, size, groupsp, limit, errnop);
+
+	free(gids);
+	free(payload);
+	return true;
+}
\ No newline at end of file
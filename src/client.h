@@ -0,0 +1,45 @@
+/*
+ * client.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_CLIENT_H
+#define NSS_MTL_CLIENT_H
+
+#include <stdbool.h>
+
+#include "lookup.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Forward queries to nss_mtld. All functions return false when the daemon
+ * could not answer, in which case the caller should resolve the query itself.
+ */
+bool nss_mtl_client_pwnam(const nss_mtl_caller_t* caller, const char* name, struct passwd* pw, char* buffer, size_t buflen, int* errnop, enum nss_status* status);
+bool nss_mtl_client_spnam(const nss_mtl_caller_t* caller, const char* name, struct spwd* spw, char* buffer, size_t buflen, int* errnop, enum nss_status* status);
+bool nss_mtl_client_grnam(const nss_mtl_caller_t* caller, const char* name, struct group* grp, char* buffer, size_t buflen, int* errnop, enum nss_status* status);
+bool nss_mtl_client_grgid(const nss_mtl_caller_t* caller, gid_t gid, struct group* grp, char* buffer, size_t buflen, int* errnop, enum nss_status* status);
+bool nss_mtl_client_initgroups(const nss_mtl_caller_t* caller, const char* user, gid_t group, long int* start, long int* size, gid_t** groupsp, long int limit, int* errnop, enum nss_status* status);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_CLIENT_H */
\ No newline at end of file
@@ -22,7 +22,8 @@
 #include <stddef.h>
 #include <string.h>
 #include <ctype.h>
-#include <search.h>
+#include <errno.h>
+#include <limits.h>
 
 #ifndef SYSLOG_NAMES
 #define SYSLOG_NAMES
@@ -35,59 +36,286 @@
 #include <syslog.h>
 
 #include "config.h"
+#include "probes.h"
+#include "stats.h"
 #include "utils.h"
 
 #ifndef NSS_MTL_CONFIG_FILE
 #define NSS_MTL_CONFIG_FILE "/etc/nss_mtl.conf"
 #endif
 
-#define KEY_VALUE_DELIMITERS "= \t\r\n"
-#define COMMA_SEPARATED_VALUE_DELIMITERS "=, \t\r\n"
+#define KEY_VALUE_DELIMITERS "= \t"
+#define COMMA_SEPARATED_VALUE_DELIMITERS "=, \t"
+#define MAP_TARGET_DELIMITERS "=: \t"
 
-static void* nss_mtl_config_uniq_list_parse(void);
-static void nss_mtl_config_uniq_list_free(void* node);
-static int nss_mtl_config_log_level_parse(const char* level);
+/* hash sets take several times the size of names they hold, reserve that much up front */
+#define NSS_MTL_CONFIG_ARENA_SIZE(file_size) (sizeof(nss_mtl_config_t) + 4096 + 8 * (file_size))
+
+/*
+ * Position within mmap'ed config file. Line ending with a backslash
+ * continues on the next one, so that long lists can be split.
+ */
+typedef struct {
+	const char* next;
+	const char* end;
+	const char* pos;
+	const char* line_end;
+	bool continued;
+} nss_mtl_config_reader_t;
+
+static bool nss_mtl_config_line_next(nss_mtl_config_reader_t* reader);
+static bool nss_mtl_config_token_next(nss_mtl_config_reader_t* reader, const char* delimiters, bool follow, nss_mtl_utils_span_t* token);
+static void nss_mtl_config_line_skip(nss_mtl_config_reader_t* reader);
+static bool nss_mtl_config_key_is(const nss_mtl_utils_span_t* key, const char* name);
+static bool nss_mtl_config_names_parse(nss_mtl_config_reader_t* reader, const char* key, nss_mtl_config_names_t* names, nss_mtl_arena_t* arena);
+static bool nss_mtl_config_names_init(nss_mtl_config_names_t* names, nss_mtl_arena_t* arena);
+static bool nss_mtl_config_target_add(nss_mtl_config_t* config, const char* name, size_t len, size_t* target);
+static bool nss_mtl_config_map_parse(nss_mtl_config_reader_t* reader, nss_mtl_config_t* config);
+static bool nss_mtl_config_map_finish(nss_mtl_config_t* config);
+static int nss_mtl_config_log_level_parse(const nss_mtl_utils_span_t* level);
+static unsigned int nss_mtl_config_log_rate_limit_parse(const nss_mtl_utils_span_t* value);
+static nss_mtl_config_t* nss_mtl_config_read(const char* path, size_t* bytes);
+static nss_mtl_snapshot_t* nss_mtl_config_load(const char* path);
+static void nss_mtl_config_destroy(nss_mtl_snapshot_t* snapshot);
+
+static nss_mtl_snapshot_slot_t nss_mtl_config_slot = NSS_MTL_SNAPSHOT_SLOT_INIT;
 
 /* implementation */
 
-void* nss_mtl_config_uniq_list_parse(void) {
-	void* tree = NULL;
-
-	/* Note: we rely here on internal buffer of strtok() function */
-	char* token = NULL;
-	while ((token = strtok(NULL, COMMA_SEPARATED_VALUE_DELIMITERS)) != NULL) {
-		char* name = strdup(token);
-		char** node = tsearch(name, &tree, nss_mtl_utils_str_cmp);
-		if (node == NULL) {
-			nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for unique list", __func__);
-			tdestroy(tree, free);
-			return NULL;
-		} else if (*node != name) {
-			nss_mtl_utils_log(LOG_WARNING, "%s: duplicate entry detected: %s", __func__, name);
-			free(name);
+bool nss_mtl_config_line_next(nss_mtl_config_reader_t* reader) {
+	if (reader->next >= reader->end) {
+		return false;
+	}
+
+	const char* newline = memchr(reader->next, '\n', reader->end - reader->next);
+	reader->pos = reader->next;
+	reader->line_end = newline != NULL ? newline : reader->end;
+	reader->next = newline != NULL ? newline + 1 : reader->end;
+
+	while (reader->line_end > reader->pos && isspace((unsigned char)reader->line_end[-1])) {
+		--reader->line_end;
+	}
+	reader->continued = reader->line_end > reader->pos && reader->line_end[-1] == '\\';
+	if (reader->continued) {
+		--reader->line_end;
+	}
+
+	return true;
+}
+
+bool nss_mtl_config_token_next(nss_mtl_config_reader_t* reader, const char* delimiters, bool follow, nss_mtl_utils_span_t* token) {
+	for (;;) {
+		while (reader->pos < reader->line_end && strchr(delimiters, *reader->pos) != NULL) {
+			++reader->pos;
+		}
+		if (reader->pos < reader->line_end) {
+			break;
+		}
+		/* only lists run over continued lines */
+		if (! follow || ! reader->continued || ! nss_mtl_config_line_next(reader)) {
+			return false;
+		}
+	}
+
+	token->start = reader->pos;
+	while (reader->pos < reader->line_end && strchr(delimiters, *reader->pos) == NULL) {
+		++reader->pos;
+	}
+	token->length = reader->pos - token->start;
+
+	return true;
+}
+
+void nss_mtl_config_line_skip(nss_mtl_config_reader_t* reader) {
+	while (reader->continued && nss_mtl_config_line_next(reader)) {
+		/* rest of the value is ignored */
+	}
+}
+
+bool nss_mtl_config_key_is(const nss_mtl_utils_span_t* key, const char* name) {
+	return nss_mtl_utils_span_eq(key, name, strlen(name));
+}
+
+bool nss_mtl_config_names_init(nss_mtl_config_names_t* names, nss_mtl_arena_t* arena) {
+	names->names = nss_mtl_utils_set_alloc(arena);
+	names->globs = nss_mtl_utils_set_alloc(arena);
+	names->patterns = NULL;
+
+	return names->names != NULL && names->globs != NULL;
+}
+
+bool nss_mtl_config_names_parse(nss_mtl_config_reader_t* reader, const char* key, nss_mtl_config_names_t* names, nss_mtl_arena_t* arena) {
+	/* last occurrence of the key wins, the previous one stays in the arena until the config goes */
+	if (! nss_mtl_config_names_init(names, arena)) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for %s", __func__, key);
+		return false;
+	}
+
+	nss_mtl_utils_span_t token;
+	while (nss_mtl_config_token_next(reader, COMMA_SEPARATED_VALUE_DELIMITERS, true, &token)) {
+		nss_mtl_utils_set_t* set = nss_mtl_pattern_is_glob(token.start, token.length) ? names->globs : names->names;
+		bool added = false;
+		if (! nss_mtl_utils_set_add(set, token.start, token.length, &added)) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for %s", __func__, key);
+			return false;
+		} else if (! added) {
+			nss_mtl_utils_log(LOG_WARNING, "%s: duplicate entry detected: %.*s", __func__, (int)token.length, token.start);
+		}
+	}
+
+	if (names->globs->count > 0) {
+		names->patterns = nss_mtl_pattern_compile(names->globs, arena);
+		if (names->patterns == NULL) {
+			if (errno == E2BIG) {
+				nss_mtl_utils_log(LOG_ERR, "%s: pattern list %s too complex", __func__, key);
+			} else {
+				nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate patterns of %s", __func__, key);
+			}
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool nss_mtl_config_names_match(const nss_mtl_config_names_t* names, const char* name) {
+	return nss_mtl_utils_set_contains(names->names, name) || (names->patterns != NULL && nss_mtl_pattern_match(names->patterns, name, NULL));
+}
+
+bool nss_mtl_config_target_add(nss_mtl_config_t* config, const char* name, size_t len, size_t* target) {
+	if (config->target_names == NULL) {
+		config->target_names = nss_mtl_utils_set_alloc(config->arena);
+		if (config->target_names == NULL) {
+			return false;
+		}
+	}
+
+	bool added = false;
+	nss_mtl_utils_set_slot_t* slot = nss_mtl_utils_set_add(config->target_names, name, len, &added);
+	if (slot == NULL) {
+		return false;
+	}
+	if (added) {
+		if (config->targets_count == NSS_MTL_CONFIG_MAX_TARGETS) {
+			nss_mtl_utils_log(LOG_ERR, "%s: more than %d target users defined", __func__, NSS_MTL_CONFIG_MAX_TARGETS);
+			return false;
+		}
+		slot->value = config->targets_count;
+		config->targets[config->targets_count++] = slot->item;
+	}
+	*target = slot->value;
+
+	return true;
+}
+
+bool nss_mtl_config_map_parse(nss_mtl_config_reader_t* reader, nss_mtl_config_t* config) {
+	if (config->map.names == NULL && ! nss_mtl_config_names_init(&config->map, config->arena)) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for map", __func__);
+		return false;
+	}
+
+	/* map = <target>: <name>, <pattern>, ... */
+	nss_mtl_utils_span_t token;
+	const bool has_target = nss_mtl_config_token_next(reader, MAP_TARGET_DELIMITERS, false, &token);
+	while (reader->pos < reader->line_end && (*reader->pos == ' ' || *reader->pos == '\t')) {
+		++reader->pos;
+	}
+	if (! has_target || reader->pos == reader->line_end || *reader->pos != ':') {
+		nss_mtl_utils_log(LOG_WARNING, "%s: map rule without target user, expected <target>: <names>", __func__);
+		nss_mtl_config_line_skip(reader);
+		return true;
+	}
+	++reader->pos;
+
+	size_t target = 0;
+	if (! nss_mtl_config_target_add(config, token.start, token.length, &target)) {
+		return false;
+	}
+
+	while (nss_mtl_config_token_next(reader, COMMA_SEPARATED_VALUE_DELIMITERS, true, &token)) {
+		nss_mtl_utils_set_t* set = nss_mtl_pattern_is_glob(token.start, token.length) ? config->map.globs : config->map.names;
+		bool added = false;
+		nss_mtl_utils_set_slot_t* slot = nss_mtl_utils_set_add(set, token.start, token.length, &added);
+		if (slot == NULL) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for map", __func__);
+			return false;
+		} else if (! added) {
+			/* first rule wins */
+			nss_mtl_utils_log(LOG_WARNING, "%s: %.*s already mapped to %s", __func__, (int)token.length, token.start, config->targets[slot->value]);
+		} else {
+			slot->value = target;
 		}
 	}
 
-	return tree;
+	return true;
 }
 
-void nss_mtl_config_uniq_list_free(void* node) {
-	(void)node;
-	/* do nothing */
+bool nss_mtl_config_map_finish(nss_mtl_config_t* config) {
+	/* target_user is just one more target, it may be named by map rules as well */
+	if (! nss_mtl_config_target_add(config, config->target_user, strlen(config->target_user), &config->target_default)) {
+		return false;
+	}
+	if (config->map.names == NULL && ! nss_mtl_config_names_init(&config->map, config->arena)) {
+		return false;
+	}
+
+	/* rules of all targets are compiled together, earlier target wins where patterns overlap */
+	if (config->map.globs->count > 0) {
+		config->map.patterns = nss_mtl_pattern_compile(config->map.globs, config->arena);
+		if (config->map.patterns == NULL) {
+			if (errno == E2BIG) {
+				nss_mtl_utils_log(LOG_ERR, "%s: pattern list map too complex", __func__);
+			} else {
+				nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate patterns of map", __func__);
+			}
+			return false;
+		}
+	}
+
+	return true;
 }
 
-int nss_mtl_config_log_level_parse(const char* level) {
-	int ret = -1;
+size_t nss_mtl_config_target(const nss_mtl_config_t* config, const char* name) {
+	/* names given literally take precedence over patterns */
+	const nss_mtl_utils_set_slot_t* slot = nss_mtl_utils_set_get(config->map.names, name);
+	if (slot != NULL) {
+		return slot->value;
+	}
+
+	uint32_t value = 0;
+	if (config->map.patterns != NULL && nss_mtl_pattern_match(config->map.patterns, name, &value)) {
+		return value;
+	}
+
+	return config->target_default;
+}
+
+bool nss_mtl_config_target_find(const nss_mtl_config_t* config, const char* name, size_t* target) {
+	const nss_mtl_utils_set_slot_t* slot = nss_mtl_utils_set_get(config->target_names, name);
+	if (slot == NULL) {
+		return false;
+	}
+
+	*target = slot->value;
+	return true;
+}
+
+int nss_mtl_config_log_level_parse(const nss_mtl_utils_span_t* level) {
 	for (int i = 0; prioritynames[i].c_name != NULL; ++i) {
-		if (strcmp(level, prioritynames[i].c_name) == 0) {
-			ret = prioritynames[i].c_val;
-			break;
+		if (nss_mtl_config_key_is(level, prioritynames[i].c_name)) {
+			return prioritynames[i].c_val;
 		}
 	}
 
-	if (ret < 0) {
-		nss_mtl_utils_log(LOG_WARNING, "%s: unknown log_level value: %s", __func__, level);
-		ret = LOG_INFO;
+	nss_mtl_utils_log(LOG_WARNING, "%s: unknown log_level value: %.*s", __func__, (int)level->length, level->start);
+	return LOG_INFO;
+}
+
+unsigned int nss_mtl_config_log_rate_limit_parse(const nss_mtl_utils_span_t* value) {
+	unsigned long ret = 0;
+	if (! nss_mtl_utils_span_id(value, &ret) || ret > UINT_MAX) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: invalid log_rate_limit value: %.*s", __func__, (int)value->length, value->start);
+		return NSS_MTL_UTILS_LOG_RATE_LIMIT;
 	}
 
 	return ret;
@@ -98,88 +326,137 @@ nss_mtl_config_t* nss_mtl_config_parse(const char* path) {
 		path = NSS_MTL_CONFIG_FILE;
 	}
 
-	FILE* f = fopen(path, "r");
-	if (f == NULL) {
-		nss_mtl_utils_log(LOG_ERR, "%s: cannot open config file %s: %m", __func__, path);
+	NSS_MTL_PROBE1(config_parse_entry, path);
+	size_t bytes = 0;
+	nss_mtl_config_t* config = nss_mtl_config_read(path, &bytes);
+	NSS_MTL_PROBE3(config_parse_return, path, config != NULL, bytes);
+
+	return config;
+}
+
+nss_mtl_config_t* nss_mtl_config_read(const char* path, size_t* bytes) {
+	const char* data = NULL;
+	size_t size = 0;
+	if (! nss_mtl_utils_file_map(path, &data, &size)) {
 		return NULL;
 	}
+	*bytes = size;
 
-	char buffer[BUFSIZ];
-	void* ignored_users = NULL;
-	size_t ignored_users_size = 0;
-	void* ignored_execs = NULL;
-	size_t ignored_execs_size = 0;
-
-	nss_mtl_config_t* config = malloc(sizeof(nss_mtl_config_t));
+	nss_mtl_arena_t* arena = nss_mtl_arena_create(NSS_MTL_CONFIG_ARENA_SIZE(size));
+	nss_mtl_config_t* config = arena != NULL ? nss_mtl_arena_calloc(arena, 1, sizeof(nss_mtl_config_t)) : NULL;
 	if (config == NULL) {
-		nss_mtl_utils_log(LOG_ERR, "%s: could not allocate config: %m", __func__);
+		nss_mtl_utils_log(LOG_ERR, "%s: could not allocate config", __func__);
+		nss_mtl_arena_destroy(arena);
+		nss_mtl_utils_file_unmap(data, size);
 		return NULL;
 	}
-	memset(config, 0, sizeof(nss_mtl_config_t));
+	nss_mtl_snapshot_init(&config->snapshot, nss_mtl_config_destroy);
+	config->arena = arena;
+	config->log_rate_limit = NSS_MTL_UTILS_LOG_RATE_LIMIT;
 
-	char* token = NULL;
-	while (fgets(buffer, sizeof(buffer), f) != NULL) {
+	nss_mtl_config_reader_t reader = { data, data + size, NULL, NULL, false };
+	nss_mtl_utils_span_t key;
+	nss_mtl_utils_span_t value;
+	bool failed = false;
+	while (! failed && nss_mtl_config_line_next(&reader)) {
 		/* ignore empty lines and comments */
-		if (buffer[0] == '#' || isspace((unsigned char)buffer[0])) {
+		if (reader.pos == reader.line_end || reader.pos[0] == '#' || isspace((unsigned char)reader.pos[0])) {
+			nss_mtl_config_line_skip(&reader);
 			continue;
 		}
-		token = strtok(buffer, KEY_VALUE_DELIMITERS);
-		if (strcmp(token, "log_level") == 0) {
-			token = strtok(NULL, KEY_VALUE_DELIMITERS);
-			if (token == NULL) {
+		nss_mtl_config_token_next(&reader, KEY_VALUE_DELIMITERS, false, &key);
+
+		if (nss_mtl_config_key_is(&key, "ignored_users")) {
+			failed = ! nss_mtl_config_names_parse(&reader, "ignored_users", &config->ignored_users, arena);
+			continue;
+		} else if (nss_mtl_config_key_is(&key, "ignored_execs")) {
+			failed = ! nss_mtl_config_names_parse(&reader, "ignored_execs", &config->ignored_execs, arena);
+			continue;
+		} else if (nss_mtl_config_key_is(&key, "map")) {
+			failed = ! nss_mtl_config_map_parse(&reader, config);
+			continue;
+		}
+
+		const bool has_value = nss_mtl_config_token_next(&reader, KEY_VALUE_DELIMITERS, true, &value);
+		if (nss_mtl_config_key_is(&key, "log_level")) {
+			if (! has_value) {
 				nss_mtl_utils_log(LOG_WARNING, "%s: missing value for log_level key", __func__);
 			} else {
-				config->log_level = nss_mtl_config_log_level_parse(token);
+				config->log_level = nss_mtl_config_log_level_parse(&value);
 			}
-		} else if (strcmp(token, "target_user") == 0) {
-			token = strtok(NULL, KEY_VALUE_DELIMITERS);
-			if (token == NULL) {
-				nss_mtl_utils_log(LOG_WARNING, "%s: missing value for target_user key", __func__);
+		} else if (nss_mtl_config_key_is(&key, "log_rate_limit")) {
+			if (! has_value) {
+				nss_mtl_utils_log(LOG_WARNING, "%s: missing value for log_rate_limit key", __func__);
 			} else {
-				config->target_user = strdup(token);
-			}
-		} else if (strcmp(token, "ignored_users") == 0) {
-			ignored_users = nss_mtl_config_uniq_list_parse();
-			if (ignored_users != NULL) {
-				twalk_r(ignored_users, nss_mtl_utils_tree_size_calc, &ignored_users_size);
+				config->log_rate_limit = nss_mtl_config_log_rate_limit_parse(&value);
 			}
-		} else if (strcmp(token, "ignored_execs") == 0) {
-			ignored_execs = nss_mtl_config_uniq_list_parse();
-			if (ignored_execs != NULL) {
-				twalk_r(ignored_execs, nss_mtl_utils_tree_size_calc, &ignored_execs_size);
+		} else if (nss_mtl_config_key_is(&key, "target_user")) {
+			if (! has_value) {
+				nss_mtl_utils_log(LOG_WARNING, "%s: missing value for target_user key", __func__);
+			} else {
+				config->target_user = nss_mtl_arena_strndup(arena, value.start, value.length);
+				failed = config->target_user == NULL;
+				if (failed) {
+					nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for target_user", __func__);
+				}
 			}
 		}
+		nss_mtl_config_line_skip(&reader);
 	}
 
-	if (config->target_user == NULL || strlen(config->target_user) == 0) {
-		nss_mtl_utils_log(LOG_ERR, "%s: target_user not defined, cannot continue", __func__);
+	nss_mtl_utils_file_unmap(data, size);
+
+	/* the step which failed already logged why */
+	if (failed) {
+		nss_mtl_utils_log(LOG_ERR, "%s: could not parse config %s", __func__, path);
 		nss_mtl_config_free(config);
 		return NULL;
 	}
 
-	config->ignored_users = nss_mtl_utils_list_alloc(ignored_users_size);
-	if (config->ignored_users == NULL) {
-		nss_mtl_utils_log(LOG_ERR, "%s: could not allocate buffer for ignored_users list of size %ld: %m", __func__, ignored_users_size);
+	if (config->target_user == NULL || strlen(config->target_user) == 0) {
+		nss_mtl_utils_log(LOG_ERR, "%s: target_user not defined, cannot continue", __func__);
 		nss_mtl_config_free(config);
 		return NULL;
 	}
-	twalk_r(ignored_users, nss_mtl_utils_list_fill, config->ignored_users);
-	tdestroy(ignored_users, nss_mtl_config_uniq_list_free);
 
-	config->ignored_execs = nss_mtl_utils_list_alloc(ignored_execs_size);
-	if (config->ignored_execs == NULL) {
-		nss_mtl_utils_log(LOG_ERR, "%s: could not allocate buffer for ignored_execs list of size %ld: %m", __func__, ignored_execs_size);
+	/* missing lists are just empty */
+	if ((config->ignored_users.names == NULL && ! nss_mtl_config_names_init(&config->ignored_users, arena))
+		|| (config->ignored_execs.names == NULL && ! nss_mtl_config_names_init(&config->ignored_execs, arena))
+		|| ! nss_mtl_config_map_finish(config)) {
+		nss_mtl_utils_log(LOG_ERR, "%s: could not build config %s", __func__, path);
 		nss_mtl_config_free(config);
 		return NULL;
 	}
-	twalk_r(ignored_execs, nss_mtl_utils_list_fill, config->ignored_execs);
-	tdestroy(ignored_execs, nss_mtl_config_uniq_list_free);
 
 	return config;
 }
 
 void nss_mtl_config_free(nss_mtl_config_t* config) {
-	nss_mtl_utils_list_free(config->ignored_users);
-	free(config->target_user);
-	free(config);
+	nss_mtl_arena_destroy(config->arena);
+}
+
+void nss_mtl_config_destroy(nss_mtl_snapshot_t* snapshot) {
+	nss_mtl_config_free((nss_mtl_config_t*)snapshot);
+}
+
+nss_mtl_snapshot_t* nss_mtl_config_load(const char* path) {
+	const uint64_t started = nss_mtl_stats_begin();
+	nss_mtl_config_t* config = nss_mtl_config_parse(path);
+	nss_mtl_stats_record(NSS_MTL_STATS_CONFIG_LOAD, started, config != NULL ? NSS_MTL_STATS_SUCCESS : NSS_MTL_STATS_UNAVAIL, 0);
+
+	return config != NULL ? &config->snapshot : NULL;
+}
+
+const nss_mtl_config_t* nss_mtl_config_acquire(void) {
+	return (const nss_mtl_config_t*)nss_mtl_snapshot_acquire_file(&nss_mtl_config_slot, NSS_MTL_CONFIG_FILE, nss_mtl_config_load);
+}
+
+const nss_mtl_config_t* nss_mtl_config_acquire_loaded(void) {
+	return (const nss_mtl_config_t*)nss_mtl_snapshot_acquire(&nss_mtl_config_slot);
+}
+
+void nss_mtl_config_release(const nss_mtl_config_t* config) {
+	if (config != NULL) {
+		nss_mtl_snapshot_release((nss_mtl_snapshot_t*)&config->snapshot);
+	}
 }
\ No newline at end of file
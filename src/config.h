@@ -22,16 +22,49 @@
 
 #include <sys/types.h>
 
+#include "pattern.h"
+#include "snapshot.h"
 #include "utils.h"
 
+/* bit masks of targets are 64 bits wide */
+#define NSS_MTL_CONFIG_MAX_TARGETS 64
+
+/* names given literally are kept in a hash set, wildcard ones are compiled together */
+typedef struct {
+	nss_mtl_utils_set_t* names;
+	nss_mtl_utils_set_t* globs;
+	nss_mtl_pattern_t* patterns;
+} nss_mtl_config_names_t;
+
 typedef struct {
+	nss_mtl_snapshot_t snapshot;
+	/* holds the config itself and everything it points to */
+	nss_mtl_arena_t* arena;
 	int log_level;
+	/* seconds between repeated messages of the same class, 0 logs all of them */
+	unsigned int log_rate_limit;
 	char* target_user;
-	nss_mtl_utils_list_t* ignored_users;
-	nss_mtl_utils_list_t* ignored_execs;
+	/* map rules, value of every name and pattern is the index of its target */
+	nss_mtl_config_names_t map;
+	/* target users in order of appearance, value of each is its index */
+	nss_mtl_utils_set_t* target_names;
+	const char* targets[NSS_MTL_CONFIG_MAX_TARGETS];
+	size_t targets_count;
+	/* index of target_user, which gets all names matching no rule */
+	size_t target_default;
+	nss_mtl_config_names_t ignored_users;
+	nss_mtl_config_names_t ignored_execs;
 } nss_mtl_config_t;
 
 nss_mtl_config_t* nss_mtl_config_parse(const char* path);
 void nss_mtl_config_free(nss_mtl_config_t* config);
+bool nss_mtl_config_names_match(const nss_mtl_config_names_t* names, const char* name);
+size_t nss_mtl_config_target(const nss_mtl_config_t* config, const char* name);
+bool nss_mtl_config_target_find(const nss_mtl_config_t* config, const char* name, size_t* target);
+
+const nss_mtl_config_t* nss_mtl_config_acquire(void);
+/* most recently loaded config, without checking the file for changes, NULL if none */
+const nss_mtl_config_t* nss_mtl_config_acquire_loaded(void);
+void nss_mtl_config_release(const nss_mtl_config_t* config);
 
 #endif /* NSS_MTL_CONFIG_H */
\ No newline at end of file
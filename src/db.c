@@ -0,0 +1,201 @@
+/*
+ * db.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "db.h"
+
+static bool nss_mtl_db_valid(const nss_mtl_db_t* db);
+static bool nss_mtl_db_write_all(int fd, const void* data, size_t size);
+
+/* implementation */
+
+bool nss_mtl_db_valid(const nss_mtl_db_t* db) {
+	const nss_mtl_db_header_t* header = db->header;
+	if (db->size < sizeof(nss_mtl_db_header_t) || header->magic != NSS_MTL_DB_MAGIC || header->version != NSS_MTL_DB_VERSION || header->size != db->size) {
+		return false;
+	}
+
+	for (size_t i = 0; i < NSS_MTL_DB_SECTIONS; ++i) {
+		const nss_mtl_db_section_t* section = &header->sections[i];
+		if (section->offset % NSS_MTL_DB_ALIGN != 0 || section->offset < sizeof(nss_mtl_db_header_t)
+			|| section->offset > db->size || section->size > db->size - section->offset) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool nss_mtl_db_open(const char* path, nss_mtl_db_t* db) {
+	assert(path != NULL);
+	assert(db != NULL);
+
+	memset(db, 0, sizeof(nss_mtl_db_t));
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		/* database is optional, text files are used without it */
+		if (errno != ENOENT) {
+			nss_mtl_utils_log(LOG_WARNING, "%s: cannot open %s: %m", __func__, path);
+		}
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(nss_mtl_db_header_t)) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: %s is not a database", __func__, path);
+		close(fd);
+		return false;
+	}
+
+	void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: cannot map %s: %m", __func__, path);
+		return false;
+	}
+
+	db->data = addr;
+	db->size = st.st_size;
+	db->header = addr;
+	if (! nss_mtl_db_valid(db)) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: %s is damaged or of other version, ignoring it", __func__, path);
+		nss_mtl_db_close(db);
+		return false;
+	}
+
+	return true;
+}
+
+void nss_mtl_db_close(nss_mtl_db_t* db) {
+	if (db->data != NULL) {
+		munmap((void*)db->data, db->size);
+	}
+	memset(db, 0, sizeof(nss_mtl_db_t));
+}
+
+const void* nss_mtl_db_section(const nss_mtl_db_t* db, nss_mtl_db_section_id_t id, size_t* size) {
+	assert(db != NULL);
+	assert(id < NSS_MTL_DB_SECTIONS);
+
+	*size = db->header->sections[id].size;
+	return db->data + db->header->sections[id].offset;
+}
+
+bool nss_mtl_db_table_valid(const size_t* table, size_t size, size_t count) {
+	/* power of two with at least one free slot, so that probing stops, and no slot past the entries */
+	const size_t slots = size / sizeof(size_t);
+	if (size % sizeof(size_t) != 0 || slots <= count || (slots & (slots - 1)) != 0) {
+		return false;
+	}
+	for (size_t i = 0; i < slots; ++i) {
+		if (table[i] > count) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool nss_mtl_db_write_all(int fd, const void* data, size_t size) {
+	const char* pos = data;
+	while (size > 0) {
+		const ssize_t written = write(fd, pos, size);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		pos += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+bool nss_mtl_db_write(const char* path, const nss_mtl_db_header_t* header, const void* const* sections) {
+	assert(path != NULL);
+	assert(header != NULL);
+	assert(sections != NULL);
+
+	nss_mtl_db_header_t layout = *header;
+	layout.magic = NSS_MTL_DB_MAGIC;
+	layout.version = NSS_MTL_DB_VERSION;
+	size_t pos = sizeof(nss_mtl_db_header_t);
+	for (size_t i = 0; i < NSS_MTL_DB_SECTIONS; ++i) {
+		pos = (pos + NSS_MTL_DB_ALIGN - 1) & ~(size_t)(NSS_MTL_DB_ALIGN - 1);
+		layout.sections[i].offset = pos;
+		pos += layout.sections[i].size;
+	}
+	layout.size = pos;
+
+	char dir[PATH_MAX];
+	char tmp[PATH_MAX];
+	strncpy(dir, path, sizeof(dir) - 1);
+	dir[sizeof(dir) - 1] = '\0';
+	if (mkdir(dirname(dir), 0755) == -1 && errno != EEXIST) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot create directory for %s: %m", __func__, path);
+		return false;
+	}
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp)) {
+		nss_mtl_utils_log(LOG_ERR, "%s: path %s is too long", __func__, path);
+		return false;
+	}
+
+	/* written aside and renamed over, so that readers see either the old file or the complete new one */
+	int fd = mkstemp(tmp);
+	if (fd == -1) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot create %s: %m", __func__, tmp);
+		return false;
+	}
+
+	static const char padding[NSS_MTL_DB_ALIGN] = { 0 };
+	bool ok = fchmod(fd, 0644) == 0 && nss_mtl_db_write_all(fd, &layout, sizeof(nss_mtl_db_header_t));
+	pos = sizeof(nss_mtl_db_header_t);
+	for (size_t i = 0; ok && i < NSS_MTL_DB_SECTIONS; ++i) {
+		const nss_mtl_db_section_t* section = &layout.sections[i];
+		ok = nss_mtl_db_write_all(fd, padding, section->offset - pos) && nss_mtl_db_write_all(fd, sections[i], section->size);
+		pos = section->offset + section->size;
+	}
+	ok = ok && fsync(fd) == 0;
+	if (close(fd) == -1) {
+		ok = false;
+	}
+
+	if (! ok || rename(tmp, path) == -1) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot write %s: %m", __func__, path);
+		unlink(tmp);
+		return false;
+	}
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+/*
+ * db.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_DB_H
+#define NSS_MTL_DB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "utils.h"
+
+#ifndef NSS_MTL_DB_FILE
+#define NSS_MTL_DB_FILE "/var/cache/nss_mtl/mtl.db"
+#endif
+
+#define NSS_MTL_DB_MAGIC 0x62646c6du
+#define NSS_MTL_DB_VERSION 1
+
+/* sections start at multiples of it, so that tables can be used in place */
+#define NSS_MTL_DB_ALIGN 16
+/* longer target names get no precomputed membership */
+#define NSS_MTL_DB_NAME_SIZE 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	/* copy of passwd file, index entries and hash table over user names, as in nss_mtl_passwd_t */
+	NSS_MTL_DB_PASSWD_DATA = 0,
+	NSS_MTL_DB_PASSWD_ENTRIES,
+	NSS_MTL_DB_PASSWD_TABLE,
+	/* copy of group file, index entries and hash tables over names and gids, as in nss_mtl_group_t */
+	NSS_MTL_DB_GROUP_DATA,
+	NSS_MTL_DB_GROUP_ENTRIES,
+	NSS_MTL_DB_GROUP_BY_NAME,
+	NSS_MTL_DB_GROUP_BY_GID,
+	/* nss_mtl_db_membership_t of every target user, pointing into the gid list */
+	NSS_MTL_DB_MEMBERSHIPS,
+	NSS_MTL_DB_MEMBERSHIP_GIDS,
+	NSS_MTL_DB_SECTIONS,
+} nss_mtl_db_section_id_t;
+
+typedef struct {
+	uint64_t offset;
+	uint64_t size;
+} nss_mtl_db_section_t;
+
+/* gids of groups listing a target user as a member, as nss_mtl_group_membership_t */
+typedef struct {
+	char user[NSS_MTL_DB_NAME_SIZE];
+	uint64_t first;
+	uint64_t count;
+} nss_mtl_db_membership_t;
+
+/*
+ * Layout of NSS_MTL_DB_FILE, written by mtl_makedb. Sections are only used
+ * while stamps of the files they were built from match the current ones,
+ * so a stale database is never worse than none. Structures are stored as
+ * they are in memory, the file is not meant to be moved between hosts.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+	nss_mtl_utils_stamp_t passwd_stamp;
+	nss_mtl_utils_stamp_t group_stamp;
+	nss_mtl_db_section_t sections[NSS_MTL_DB_SECTIONS];
+} nss_mtl_db_header_t;
+
+/* read only mapping of the whole file */
+typedef struct {
+	const char* data;
+	size_t size;
+	const nss_mtl_db_header_t* header;
+} nss_mtl_db_t;
+
+bool nss_mtl_db_open(const char* path, nss_mtl_db_t* db);
+void nss_mtl_db_close(nss_mtl_db_t* db);
+const void* nss_mtl_db_section(const nss_mtl_db_t* db, nss_mtl_db_section_id_t id, size_t* size);
+/* whether hash table section of given size in bytes is usable for count entries */
+bool nss_mtl_db_table_valid(const size_t* table, size_t size, size_t count);
+/* stamps and section sizes come from the header, offsets and total size are filled in here */
+bool nss_mtl_db_write(const char* path, const nss_mtl_db_header_t* header, const void* const* sections);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_DB_H */
\ No newline at end of file
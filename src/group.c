@@ -0,0 +1,525 @@
+/*
+ * group.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <syslog.h>
+
+#include "group.h"
+#include "probes.h"
+#include "stats.h"
+
+static nss_mtl_snapshot_t* nss_mtl_group_load(const char* path);
+static void nss_mtl_group_destroy(nss_mtl_snapshot_t* snapshot);
+static bool nss_mtl_group_entries_add(nss_mtl_group_t* index, const nss_mtl_utils_span_t* line, size_t* capacity);
+static bool nss_mtl_group_tables_build(nss_mtl_group_t* index);
+static bool nss_mtl_group_db_load(nss_mtl_group_t* index, const char* path);
+static const nss_mtl_db_membership_t* nss_mtl_group_db_membership(const nss_mtl_group_t* index, const char* user, const gid_t** gids);
+static uint32_t nss_mtl_group_gid_hash(gid_t gid);
+static const nss_mtl_group_entry_t* nss_mtl_group_name_lookup(const nss_mtl_group_t* index, const char* name, size_t len, uint32_t hash, size_t* slot);
+static const nss_mtl_group_entry_t* nss_mtl_group_gid_lookup(const nss_mtl_group_t* index, gid_t gid, size_t* slot);
+static size_t nss_mtl_group_members_count(const nss_mtl_utils_span_t* members, size_t* size);
+static nss_mtl_group_membership_t* nss_mtl_group_membership_load(const nss_mtl_group_t* index, const char* user);
+static void nss_mtl_group_membership_destroy(nss_mtl_snapshot_t* snapshot);
+
+static nss_mtl_snapshot_slot_t nss_mtl_group_slot = NSS_MTL_SNAPSHOT_SLOT_INIT;
+/* memberships of a few users are kept at once, so that queries alternating between targets do not evict each other */
+static nss_mtl_snapshot_slot_t nss_mtl_group_membership_slots[NSS_MTL_GROUP_MEMBERSHIP_SLOTS] = {
+	NSS_MTL_SNAPSHOT_SLOT_INIT, NSS_MTL_SNAPSHOT_SLOT_INIT, NSS_MTL_SNAPSHOT_SLOT_INIT, NSS_MTL_SNAPSHOT_SLOT_INIT
+};
+
+/* implementation */
+
+bool nss_mtl_group_entries_add(nss_mtl_group_t* index, const nss_mtl_utils_span_t* line, size_t* capacity) {
+	/* only name and gid are needed here, member list is left for lookup time */
+	const char* end = line->start + line->length;
+	const char* name_end = memchr(line->start, ':', line->length);
+	const char* passwd_end = name_end != NULL ? memchr(name_end + 1, ':', end - name_end - 1) : NULL;
+	const char* gid_end = passwd_end != NULL ? memchr(passwd_end + 1, ':', end - passwd_end - 1) : NULL;
+	if (gid_end == NULL) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: skipping malformed line in %s", __func__, NSS_MTL_GROUP_FILE);
+		return true;
+	}
+
+	unsigned long gid = 0;
+	nss_mtl_utils_span_t gid_span = { passwd_end + 1, gid_end - passwd_end - 1 };
+	if (name_end == line->start || ! nss_mtl_utils_span_id(&gid_span, &gid)) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: skipping malformed line in %s", __func__, NSS_MTL_GROUP_FILE);
+		return true;
+	}
+
+	if (index->count == *capacity) {
+		const size_t new_capacity = *capacity > 0 ? *capacity * 2 : 64;
+		nss_mtl_group_entry_t* entries = realloc(index->entries, new_capacity * sizeof(nss_mtl_group_entry_t));
+		if (entries == NULL) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for %lu entries", __func__, new_capacity);
+			return false;
+		}
+		index->entries = entries;
+		*capacity = new_capacity;
+	}
+
+	nss_mtl_group_entry_t* entry = &index->entries[index->count++];
+	entry->offset = line->start - index->data;
+	entry->length = line->length;
+	entry->name_length = name_end - line->start;
+	entry->hash = nss_mtl_utils_hash(line->start, entry->name_length);
+	entry->gid = gid;
+
+	return true;
+}
+
+uint32_t nss_mtl_group_gid_hash(gid_t gid) {
+	/* Knuth's multiplicative hash, gids tend to be dense */
+	return (uint32_t)gid * 2654435761u;
+}
+
+bool nss_mtl_group_tables_build(nss_mtl_group_t* index) {
+	/* keep load factor at or below 50% so that probe sequences stay short */
+	size_t size = 16;
+	while (size < index->count * 2) {
+		size *= 2;
+	}
+
+	index->by_name = calloc(size, sizeof(size_t));
+	index->by_gid = calloc(size, sizeof(size_t));
+	if (index->by_name == NULL || index->by_gid == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate hash tables of size %lu", __func__, size);
+		return false;
+	}
+	index->mask = size - 1;
+
+	for (size_t i = 0; i < index->count; ++i) {
+		const nss_mtl_group_entry_t* entry = &index->entries[i];
+		size_t slot = 0;
+		/* first entry wins, just like a sequential scan would */
+		if (nss_mtl_group_name_lookup(index, index->data + entry->offset, entry->name_length, entry->hash, &slot) == NULL) {
+			index->by_name[slot] = i + 1;
+		}
+		if (nss_mtl_group_gid_lookup(index, entry->gid, &slot) == NULL) {
+			index->by_gid[slot] = i + 1;
+		}
+	}
+
+	return true;
+}
+
+const nss_mtl_group_entry_t* nss_mtl_group_name_lookup(const nss_mtl_group_t* index, const char* name, size_t len, uint32_t hash, size_t* slot) {
+	size_t pos = hash & index->mask;
+	while (index->by_name[pos] != 0) {
+		const nss_mtl_group_entry_t* entry = &index->entries[index->by_name[pos] - 1];
+		if (entry->hash == hash && entry->name_length == len && memcmp(index->data + entry->offset, name, len) == 0) {
+			return entry;
+		}
+		pos = (pos + 1) & index->mask;
+	}
+
+	if (slot != NULL) {
+		*slot = pos;
+	}
+
+	return NULL;
+}
+
+const nss_mtl_group_entry_t* nss_mtl_group_gid_lookup(const nss_mtl_group_t* index, gid_t gid, size_t* slot) {
+	size_t pos = nss_mtl_group_gid_hash(gid) & index->mask;
+	while (index->by_gid[pos] != 0) {
+		const nss_mtl_group_entry_t* entry = &index->entries[index->by_gid[pos] - 1];
+		if (entry->gid == gid) {
+			return entry;
+		}
+		pos = (pos + 1) & index->mask;
+	}
+
+	if (slot != NULL) {
+		*slot = pos;
+	}
+
+	return NULL;
+}
+
+bool nss_mtl_group_db_load(nss_mtl_group_t* index, const char* path) {
+	nss_mtl_utils_stamp_t stamp;
+	if (! nss_mtl_utils_stamp_read(path, &stamp) || ! nss_mtl_db_open(NSS_MTL_DB_FILE, &index->db)) {
+		return false;
+	}
+	if (! nss_mtl_utils_stamp_equal(&index->db.header->group_stamp, &stamp)) {
+		nss_mtl_utils_log(LOG_DEBUG, "%s: %s changed since %s was built", __func__, path, NSS_MTL_DB_FILE);
+		nss_mtl_db_close(&index->db);
+		return false;
+	}
+
+	size_t entries_size = 0;
+	size_t by_name_size = 0;
+	size_t by_gid_size = 0;
+	index->data = nss_mtl_db_section(&index->db, NSS_MTL_DB_GROUP_DATA, &index->size);
+	index->entries = (nss_mtl_group_entry_t*)nss_mtl_db_section(&index->db, NSS_MTL_DB_GROUP_ENTRIES, &entries_size);
+	index->by_name = (size_t*)nss_mtl_db_section(&index->db, NSS_MTL_DB_GROUP_BY_NAME, &by_name_size);
+	index->by_gid = (size_t*)nss_mtl_db_section(&index->db, NSS_MTL_DB_GROUP_BY_GID, &by_gid_size);
+	index->count = entries_size / sizeof(nss_mtl_group_entry_t);
+	index->mask = by_name_size / sizeof(size_t) - 1;
+
+	/* lines themselves were validated by mtl_makedb, only bounds are checked here */
+	bool valid = entries_size % sizeof(nss_mtl_group_entry_t) == 0 && by_gid_size == by_name_size
+		&& nss_mtl_db_table_valid(index->by_name, by_name_size, index->count) && nss_mtl_db_table_valid(index->by_gid, by_gid_size, index->count);
+	for (size_t i = 0; valid && i < index->count; ++i) {
+		const nss_mtl_group_entry_t* entry = &index->entries[i];
+		valid = entry->offset <= index->size && entry->length <= index->size - entry->offset && entry->name_length < entry->length;
+	}
+	if (! valid) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: group index in %s is damaged, ignoring it", __func__, NSS_MTL_DB_FILE);
+		nss_mtl_db_close(&index->db);
+		index->entries = NULL;
+		index->by_name = NULL;
+		index->by_gid = NULL;
+		index->count = 0;
+		return false;
+	}
+
+	return true;
+}
+
+const nss_mtl_db_membership_t* nss_mtl_group_db_membership(const nss_mtl_group_t* index, const char* user, const gid_t** gids) {
+	if (index->db.data == NULL) {
+		return NULL;
+	}
+
+	size_t size = 0;
+	size_t gids_size = 0;
+	const nss_mtl_db_membership_t* memberships = nss_mtl_db_section(&index->db, NSS_MTL_DB_MEMBERSHIPS, &size);
+	*gids = nss_mtl_db_section(&index->db, NSS_MTL_DB_MEMBERSHIP_GIDS, &gids_size);
+
+	/* only target users are there, so there are few of them */
+	for (size_t i = 0; i < size / sizeof(nss_mtl_db_membership_t); ++i) {
+		const nss_mtl_db_membership_t* membership = &memberships[i];
+		if (strncmp(membership->user, user, NSS_MTL_DB_NAME_SIZE) == 0 && membership->user[NSS_MTL_DB_NAME_SIZE - 1] == '\0') {
+			const size_t total = gids_size / sizeof(gid_t);
+			return membership->first <= total && membership->count <= total - membership->first ? membership : NULL;
+		}
+	}
+
+	return NULL;
+}
+
+nss_mtl_snapshot_t* nss_mtl_group_load(const char* path) {
+	const uint64_t started = nss_mtl_stats_begin();
+	NSS_MTL_PROBE1(group_load_entry, path);
+	nss_mtl_group_t* index = calloc(1, sizeof(nss_mtl_group_t));
+	if (index == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate group index: %m", __func__);
+		NSS_MTL_PROBE3(group_load_return, path, false, 0);
+		return NULL;
+	}
+	nss_mtl_snapshot_init(&index->snapshot, nss_mtl_group_destroy);
+
+	if (nss_mtl_group_db_load(index, path)) {
+		nss_mtl_utils_log(LOG_DEBUG, "%s: using %lu groups of %s from %s", __func__, index->count, path, NSS_MTL_DB_FILE);
+		nss_mtl_stats_record(NSS_MTL_STATS_GROUP_LOAD, started, NSS_MTL_STATS_SUCCESS, 0);
+		NSS_MTL_PROBE3(group_load_return, path, true, 0);
+		return &index->snapshot;
+	}
+
+	if (! nss_mtl_utils_file_map(path, &index->data, &index->size)) {
+		free(index);
+		NSS_MTL_PROBE3(group_load_return, path, false, 0);
+		return NULL;
+	}
+
+	size_t capacity = 0;
+	const char* pos = index->data;
+	const char* end = index->data + index->size;
+	while (pos < end) {
+		const char* eol = memchr(pos, '\n', end - pos);
+		nss_mtl_utils_span_t line = { pos, (eol != NULL ? eol : end) - pos };
+		if (line.length > 0 && ! nss_mtl_group_entries_add(index, &line, &capacity)) {
+			nss_mtl_group_destroy(&index->snapshot);
+			NSS_MTL_PROBE3(group_load_return, path, false, 0);
+			return NULL;
+		}
+		pos += line.length + 1;
+	}
+
+	if (! nss_mtl_group_tables_build(index)) {
+		nss_mtl_group_destroy(&index->snapshot);
+		NSS_MTL_PROBE3(group_load_return, path, false, 0);
+		return NULL;
+	}
+
+	nss_mtl_utils_log(LOG_DEBUG, "%s: indexed %lu groups from %s", __func__, index->count, path);
+	nss_mtl_stats_record(NSS_MTL_STATS_GROUP_LOAD, started, NSS_MTL_STATS_SUCCESS, index->size);
+	NSS_MTL_PROBE3(group_load_return, path, true, index->size);
+
+	return &index->snapshot;
+}
+
+void nss_mtl_group_destroy(nss_mtl_snapshot_t* snapshot) {
+	nss_mtl_group_t* index = (nss_mtl_group_t*)snapshot;
+
+	if (index->db.data != NULL) {
+		nss_mtl_db_close(&index->db);
+	} else {
+		nss_mtl_utils_file_unmap(index->data, index->size);
+		free(index->entries);
+		free(index->by_name);
+		free(index->by_gid);
+	}
+	free(index);
+}
+
+const nss_mtl_group_t* nss_mtl_group_acquire(void) {
+	return (const nss_mtl_group_t*)nss_mtl_snapshot_acquire_file(&nss_mtl_group_slot, NSS_MTL_GROUP_FILE, nss_mtl_group_load);
+}
+
+void nss_mtl_group_release(const nss_mtl_group_t* index) {
+	if (index != NULL) {
+		nss_mtl_snapshot_release((nss_mtl_snapshot_t*)&index->snapshot);
+	}
+}
+
+const nss_mtl_group_entry_t* nss_mtl_group_find_name(const nss_mtl_group_t* index, const char* name) {
+	assert(index != NULL);
+	assert(name != NULL);
+
+	const size_t len = strlen(name);
+	return nss_mtl_group_name_lookup(index, name, len, nss_mtl_utils_hash(name, len), NULL);
+}
+
+const nss_mtl_group_entry_t* nss_mtl_group_find_gid(const nss_mtl_group_t* index, gid_t gid) {
+	assert(index != NULL);
+
+	return nss_mtl_group_gid_lookup(index, gid, NULL);
+}
+
+char* nss_mtl_group_entry_parse(const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry, struct group* grp) {
+	assert(index != NULL);
+	assert(entry != NULL);
+	assert(grp != NULL);
+
+	const char* line = index->data + entry->offset;
+	size_t members = 1;
+	for (size_t i = 0; i < entry->length; ++i) {
+		members += line[i] == ',';
+	}
+
+	/* member pointers first to keep them aligned, then copy of the line */
+	const size_t mem_size = (members + 1) * sizeof(char*);
+	char* storage = malloc(mem_size + entry->length + 1);
+	if (storage == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for group entry: %m", __func__);
+		return NULL;
+	}
+	char** mem = (char**)storage;
+	char* copy = storage + mem_size;
+	memcpy(copy, line, entry->length);
+	copy[entry->length] = '\0';
+
+	char* saveptr = NULL;
+	grp->gr_name = strtok_r(copy, ":", &saveptr);
+	char* passwd_end = strchr(saveptr, ':');
+	grp->gr_passwd = saveptr;
+	*passwd_end = '\0';
+	grp->gr_gid = entry->gid;
+	char* members_start = strchr(passwd_end + 1, ':') + 1;
+
+	size_t idx = 0;
+	char* member = NULL;
+	for (member = strtok_r(members_start, ",", &saveptr); member != NULL; member = strtok_r(NULL, ",", &saveptr)) {
+		mem[idx++] = member;
+	}
+	mem[idx] = NULL;
+	grp->gr_mem = mem;
+
+	return storage;
+}
+
+void nss_mtl_group_entry_members(const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry, nss_mtl_utils_span_t* members) {
+	/* line was validated while building the index, so three colons are there */
+	const char* line = index->data + entry->offset;
+	const char* pos = line + entry->name_length + 1;
+	pos = (const char*)memchr(pos, ':', line + entry->length - pos) + 1;
+	pos = (const char*)memchr(pos, ':', line + entry->length - pos) + 1;
+
+	members->start = pos;
+	members->length = line + entry->length - pos;
+}
+
+size_t nss_mtl_group_members_count(const nss_mtl_utils_span_t* members, size_t* size) {
+	/* empty items are dropped, just like strtok_r() does in nss_mtl_group_entry_parse() */
+	size_t count = 0;
+	*size = 0;
+	const char* pos = members->start;
+	const char* end = members->start + members->length;
+	while (pos < end) {
+		const char* comma = memchr(pos, ',', end - pos);
+		const char* item_end = comma != NULL ? comma : end;
+		if (item_end > pos) {
+			++count;
+			*size += item_end - pos + 1;
+		}
+		pos = item_end + 1;
+	}
+
+	return count;
+}
+
+size_t nss_mtl_group_entry_image_size(const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry) {
+	assert(index != NULL);
+	assert(entry != NULL);
+
+	nss_mtl_utils_span_t members;
+	nss_mtl_group_entry_members(index, entry, &members);
+	size_t members_size = 0;
+	const size_t count = nss_mtl_group_members_count(&members, &members_size);
+
+	/* name and password keep the colons following them as terminators, gid is not stored */
+	const char* line = index->data + entry->offset;
+	const size_t passwd_length = (const char*)memchr(line + entry->name_length + 1, ':', entry->length - entry->name_length - 1) - line - entry->name_length - 1;
+
+	return (count + 1) * sizeof(char*) + entry->name_length + 1 + passwd_length + 1 + members_size;
+}
+
+void nss_mtl_group_entry_image(const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry, struct group* grp, char* buffer) {
+	assert(index != NULL);
+	assert(entry != NULL);
+	assert(grp != NULL);
+	assert(buffer != NULL);
+
+	/* same layout as an adapted group, member pointers first, written straight from the line */
+	nss_mtl_utils_span_t members;
+	nss_mtl_group_entry_members(index, entry, &members);
+	size_t members_size = 0;
+	const size_t count = nss_mtl_group_members_count(&members, &members_size);
+
+	const char* line = index->data + entry->offset;
+	const char* passwd = line + entry->name_length + 1;
+	const char* passwd_end = memchr(passwd, ':', line + entry->length - passwd);
+
+	char** mem = (char**)buffer;
+	char* pos = buffer + (count + 1) * sizeof(char*);
+	grp->gr_name = pos;
+	pos = mempcpy(pos, line, entry->name_length);
+	*pos++ = '\0';
+	grp->gr_passwd = pos;
+	pos = mempcpy(pos, passwd, passwd_end - passwd);
+	*pos++ = '\0';
+	grp->gr_gid = entry->gid;
+
+	size_t idx = 0;
+	const char* item = members.start;
+	const char* end = members.start + members.length;
+	while (item < end) {
+		const char* comma = memchr(item, ',', end - item);
+		const char* item_end = comma != NULL ? comma : end;
+		if (item_end > item) {
+			mem[idx++] = pos;
+			pos = mempcpy(pos, item, item_end - item);
+			*pos++ = '\0';
+		}
+		item = item_end + 1;
+	}
+	mem[idx] = NULL;
+	grp->gr_mem = mem;
+}
+
+nss_mtl_group_membership_t* nss_mtl_group_membership_load(const nss_mtl_group_t* index, const char* user) {
+	const size_t len = strlen(user);
+	NSS_MTL_PROBE1(group_scan_entry, user);
+
+	size_t count = 0;
+	gid_t* gids = malloc((index->count + 1) * sizeof(gid_t));
+	if (gids == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for %lu gids", __func__, index->count);
+		return NULL;
+	}
+
+	/* memberships of target users are precomputed in the database, others need a scan over all groups */
+	const gid_t* precomputed = NULL;
+	const nss_mtl_db_membership_t* stored = nss_mtl_group_db_membership(index, user, &precomputed);
+	if (stored != NULL) {
+		count = stored->count;
+		memcpy(gids, precomputed + stored->first, count * sizeof(gid_t));
+	}
+	for (size_t i = 0; stored == NULL && i < index->count; ++i) {
+		nss_mtl_utils_span_t members;
+		nss_mtl_group_entry_members(index, &index->entries[i], &members);
+		if (nss_mtl_utils_span_has_item(&members, ',', user, len)) {
+			gids[count++] = index->entries[i].gid;
+		}
+	}
+
+	nss_mtl_group_membership_t* membership = malloc(sizeof(nss_mtl_group_membership_t) + count * sizeof(gid_t));
+	if (membership == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate membership of %s: %m", __func__, user);
+		free(gids);
+		return NULL;
+	}
+	nss_mtl_snapshot_init(&membership->snapshot, nss_mtl_group_membership_destroy);
+	membership->group_generation = index->snapshot.generation;
+	membership->user = strdup(user);
+	membership->count = count;
+	memcpy(membership->gids, gids, count * sizeof(gid_t));
+	free(gids);
+
+	if (membership->user == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate membership of %s: %m", __func__, user);
+		free(membership);
+		return NULL;
+	}
+
+	nss_mtl_utils_log(LOG_DEBUG, "%s: user %s is a member of %lu groups", __func__, user, count);
+	NSS_MTL_PROBE4(group_scan_return, user, stored != NULL, count, stored != NULL ? 0 : index->size);
+
+	return membership;
+}
+
+void nss_mtl_group_membership_destroy(nss_mtl_snapshot_t* snapshot) {
+	nss_mtl_group_membership_t* membership = (nss_mtl_group_membership_t*)snapshot;
+
+	free(membership->user);
+	free(membership);
+}
+
+const nss_mtl_group_membership_t* nss_mtl_group_membership_acquire(const nss_mtl_group_t* index, const char* user) {
+	assert(index != NULL);
+	assert(user != NULL);
+
+	nss_mtl_snapshot_slot_t* slot = &nss_mtl_group_membership_slots[nss_mtl_utils_hash(user, strlen(user)) % NSS_MTL_GROUP_MEMBERSHIP_SLOTS];
+	nss_mtl_group_membership_t* membership = (nss_mtl_group_membership_t*)nss_mtl_snapshot_acquire(slot);
+	if (membership != NULL) {
+		if (membership->group_generation == index->snapshot.generation && strcmp(membership->user, user) == 0) {
+			return membership;
+		}
+		nss_mtl_group_membership_release(membership);
+	}
+
+	membership = nss_mtl_group_membership_load(index, user);
+	if (membership == NULL) {
+		return NULL;
+	}
+	nss_mtl_snapshot_publish(slot, &membership->snapshot);
+
+	return membership;
+}
+
+void nss_mtl_group_membership_release(const nss_mtl_group_membership_t* membership) {
+	if (membership != NULL) {
+		nss_mtl_snapshot_release((nss_mtl_snapshot_t*)&membership->snapshot);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+/*
+ * group.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_GROUP_H
+#define NSS_MTL_GROUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <grp.h>
+#include <sys/types.h>
+
+#include "db.h"
+#include "snapshot.h"
+#include "utils.h"
+
+#ifndef NSS_MTL_GROUP_FILE
+#define NSS_MTL_GROUP_FILE "/etc/group"
+#endif
+
+/* number of users whose membership is cached at once */
+#define NSS_MTL_GROUP_MEMBERSHIP_SLOTS 4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	size_t offset;
+	size_t length;
+	size_t name_length;
+	uint32_t hash;
+	gid_t gid;
+} nss_mtl_group_entry_t;
+
+/*
+ * mmap'ed copy of group file with hash indexes over group names and gids,
+ * all of them pointing into the database instead when it is up to date
+ */
+typedef struct nss_mtl_group {
+	nss_mtl_snapshot_t snapshot;
+	nss_mtl_db_t db;
+	const char* data;
+	size_t size;
+	size_t count;
+	nss_mtl_group_entry_t* entries;
+	size_t mask;
+	size_t* by_name;
+	size_t* by_gid;
+} nss_mtl_group_t;
+
+/* gids of all groups listing given user as a member */
+typedef struct {
+	nss_mtl_snapshot_t snapshot;
+	unsigned long group_generation;
+	char* user;
+	size_t count;
+	gid_t gids[];
+} nss_mtl_group_membership_t;
+
+const nss_mtl_group_t* nss_mtl_group_acquire(void);
+void nss_mtl_group_release(const nss_mtl_group_t* index);
+
+const nss_mtl_group_entry_t* nss_mtl_group_find_name(const nss_mtl_group_t* index, const char* name);
+const nss_mtl_group_entry_t* nss_mtl_group_find_gid(const nss_mtl_group_t* index, gid_t gid);
+char* nss_mtl_group_entry_parse(const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry, struct group* grp);
+void nss_mtl_group_entry_members(const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry, nss_mtl_utils_span_t* members);
+size_t nss_mtl_group_entry_image_size(const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry);
+void nss_mtl_group_entry_image(const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry, struct group* grp, char* buffer);
+
+const nss_mtl_group_membership_t* nss_mtl_group_membership_acquire(const nss_mtl_group_t* index, const char* user);
+void nss_mtl_group_membership_release(const nss_mtl_group_membership_t* membership);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_GROUP_H */
\ No newline at end of file
@@ -0,0 +1,59 @@
+/*
+ * lookup.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_LOOKUP_H
+#define NSS_MTL_LOOKUP_H
+
+#include <stdbool.h>
+#include <nss.h>
+#include <pwd.h>
+#include <grp.h>
+#include <shadow.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Process on whose behalf a query is resolved. Outside of nss_mtld this is
+ * always the current process.
+ */
+typedef struct {
+	const char* exec;
+	const char* session_user;
+	/* relayed by nss_mtld, whose thread is gone before caller retries */
+	bool remote;
+} nss_mtl_caller_t;
+
+enum nss_status nss_mtl_lookup_pwnam(const nss_mtl_caller_t* caller, const char* name, struct passwd* pw, char* buffer, size_t buflen, int* errnop);
+enum nss_status nss_mtl_lookup_spnam(const nss_mtl_caller_t* caller, const char* name, struct spwd* spw, char* buffer, size_t buflen, int* errnop);
+enum nss_status nss_mtl_lookup_grnam(const nss_mtl_caller_t* caller, const char* name, struct group* grp, char* buffer, size_t buflen, int* errnop);
+enum nss_status nss_mtl_lookup_grgid(const nss_mtl_caller_t* caller, gid_t gid, struct group* grp, char* buffer, size_t buflen, int* errnop);
+enum nss_status nss_mtl_lookup_initgroups(const nss_mtl_caller_t* caller, const char* user, gid_t group, long int* start, long int* size, gid_t** groupsp, long int limit, int* errnop);
+
+/* bytes to skip at the start of caller's buffer, so that a group member array placed there is aligned */
+size_t nss_mtl_group_adapt_padding(const char* buffer);
+
+enum nss_status nss_mtl_lookup_groups_add(const gid_t* gids, size_t count, gid_t group, long int* start, long int* size, gid_t** groupsp, long int limit, int* errnop);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_LOOKUP_H */
\ No newline at end of file
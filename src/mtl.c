@@ -23,49 +23,168 @@
 #include <string.h>
 #include <ctype.h>
 #include <syslog.h>
-#include <fcntl.h>
 #include <limits.h>
 #include <errno.h>
 #include <assert.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "mtl.h"
+#include "client.h"
 #include "config.h"
+#include "group.h"
+#include "lookup.h"
+#include "passwd.h"
+#include "probes.h"
+#include "session.h"
+#include "stats.h"
 #include "utils.h"
 
 extern char* __progname;
 
-#ifndef NSS_MTL_GROUP_FILE
-#define NSS_MTL_GROUP_FILE "/etc/group"
-#endif
-
+/*
+ * Target user profile with passwd reply prepacked into blob:
+ * "x\0<gecos>\0<shell>\0<homedir root>", so that filling caller's buffer
+ * needs only appending "/<name>\0" after homedir root.
+ */
 typedef struct {
 	uid_t uid;
 	gid_t gid;
-	char* gecos;
-	char* homedir_root;
-	char* shell;
+	size_t gecos_offset;
+	size_t shell_offset;
+	size_t homedir_offset;
+	size_t size;
+	char blob[];
 } nss_mtl_user_info_t;
 
+/* profiles of all config targets, indexed like config->targets, NULL for users missing in passwd */
+typedef struct {
+	nss_mtl_snapshot_t snapshot;
+	/* holds the profiles themselves and all infos */
+	nss_mtl_arena_t* arena;
+	unsigned long config_generation;
+	unsigned long passwd_generation;
+	nss_mtl_user_info_t* infos[NSS_MTL_CONFIG_MAX_TARGETS];
+} nss_mtl_profiles_t;
+
+/* room for the profiles and a typical passwd entry of every target */
+#define NSS_MTL_PROFILES_ARENA_SIZE(targets) (sizeof(nss_mtl_profiles_t) + (targets) * 256)
+
+/* what expanding target users brings into a single group */
+typedef struct {
+	/* bit n set when config target n is a group member */
+	uint64_t targets;
+	/* user of calling session, when not active already but mapped onto one of the targets */
+	const char* extra_user;
+	size_t extra_target;
+} nss_mtl_group_expansion_t;
+
+/* how long ERANGE result waits for the retry, in seconds */
+#define NSS_MTL_GROUP_MEMO_TTL 1
+
+typedef enum {
+	NSS_MTL_GROUP_MEMO_NONE = 0,
+	NSS_MTL_GROUP_MEMO_NAME,
+	NSS_MTL_GROUP_MEMO_GID,
+} nss_mtl_group_memo_kind_t;
+
+/*
+ * Group reply that did not fit into caller's buffer, adapted into image
+ * which is copied over when caller retries with larger one.
+ */
+typedef struct {
+	nss_mtl_group_memo_kind_t kind;
+	char* session_user;
+	struct group grp;
+	char* image;
+	size_t size;
+	long created;
+} nss_mtl_group_memo_t;
+
+/* how long a getpwnam decision is reused by getspnam, in seconds */
+#define NSS_MTL_DECISION_TTL 1
+
+/*
+ * Whether the last user resolved by getpwnam in this thread was ignored,
+ * so that getspnam following it for the same name, as PAM and sshd do,
+ * needs no config file check and no passwd lookup.
+ */
+typedef struct {
+	char name[LOGIN_NAME_MAX + 1];
+	char exec[NAME_MAX + 1];
+	unsigned long config_generation;
+	long created;
+	bool ignored;
+} nss_mtl_decision_t;
+
+/* group adapted for enumeration, its pointers lead into snapshot data */
+typedef struct {
+	struct group grp;
+	size_t offset;
+	size_t size;
+} nss_mtl_grent_entry_t;
+
+/*
+ * Whole group database adapted for enumeration, so that getgrent_r() only
+ * copies the image under cursor into caller's buffer.
+ */
+typedef struct {
+	nss_mtl_snapshot_t snapshot;
+	unsigned long config_generation;
+	unsigned long session_generation;
+	unsigned long group_generation;
+	char* session_user;
+	size_t count;
+	nss_mtl_grent_entry_t* entries;
+	char* data;
+} nss_mtl_grent_t;
+
 static char* nss_mtl_alloc_static(char** buffer, size_t* buflen, size_t size);
 static bool nss_mtl_user_ignored(const nss_mtl_config_t* config, const char* name);
 static bool nss_mtl_exec_ignored(const nss_mtl_config_t* config, const char* name);
-static char* nss_mtl_parent_dir(const char* path);
-static nss_mtl_user_info_t* nss_mtl_user_info_read(const char* name);
-static void nss_mtl_user_info_free(nss_mtl_user_info_t* info);
-static bool nss_mtl_group_adapt(nss_mtl_config_t* config, nss_mtl_utils_list_t* active_users, struct group* dst, const struct group* src, char* buffer, size_t buflen);
+static size_t nss_mtl_parent_dir_length(const nss_mtl_utils_span_t* path);
+static nss_mtl_user_info_t* nss_mtl_user_info_read(const nss_mtl_passwd_t* passwd, const char* name, nss_mtl_arena_t* arena);
+static nss_mtl_profiles_t* nss_mtl_profiles_load(const nss_mtl_config_t* config, const nss_mtl_passwd_t* passwd);
+static void nss_mtl_profiles_destroy(nss_mtl_snapshot_t* snapshot);
+static const nss_mtl_profiles_t* nss_mtl_profiles_acquire(const nss_mtl_config_t* config);
+static void nss_mtl_profiles_release(const nss_mtl_profiles_t* profiles);
+static void nss_mtl_group_expansion_init(const nss_mtl_config_t* config, const nss_mtl_session_t* session, const char* session_user, const struct group* src, nss_mtl_group_expansion_t* expansion);
+static uint64_t nss_mtl_group_targets(const nss_mtl_config_t* config, const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry);
+static bool nss_mtl_group_member_duplicate(const nss_mtl_session_t* session, const nss_mtl_group_expansion_t* expansion, const char* member);
+static size_t nss_mtl_group_adapt_size(const nss_mtl_config_t* config, const nss_mtl_session_t* session, const char* session_user, const struct group* src);
+static void nss_mtl_group_adapt(const nss_mtl_config_t* config, const nss_mtl_session_t* session, const char* session_user, struct group* dst, const struct group* src, char* buffer);
+static enum nss_status nss_mtl_group_output(nss_mtl_group_memo_kind_t kind, const nss_mtl_config_t* config, const nss_mtl_session_t* session, const char* session_user, const struct group* src, struct group* grp, char* buffer, size_t buflen, int* errnop);
+static bool nss_mtl_group_image_copy(const struct group* src, const char* image, size_t size, struct group* grp, char* buffer, size_t buflen);
+static void nss_mtl_group_memo_clear(void);
+static void nss_mtl_group_memo_store(nss_mtl_group_memo_kind_t kind, const nss_mtl_config_t* config, const nss_mtl_session_t* session, const char* session_user, const struct group* src, size_t size);
+static bool nss_mtl_group_memo_take(nss_mtl_group_memo_kind_t kind, const char* name, gid_t gid, const char* session_user, struct group* grp, char* buffer, size_t buflen, int* errnop, enum nss_status* status);
+static enum nss_status nss_mtl_group_reply(const nss_mtl_caller_t* caller, nss_mtl_group_memo_kind_t kind, const nss_mtl_config_t* config, const nss_mtl_session_t* session, const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry, struct group* grp, char* buffer, size_t buflen, int* errnop);
+static void nss_mtl_decision_store(const nss_mtl_caller_t* caller, const nss_mtl_config_t* config, const char* name, bool ignored);
+static const nss_mtl_config_t* nss_mtl_decision_find(const nss_mtl_caller_t* caller, const char* name, bool* ignored);
 static long nss_mtl_today();
-
-static FILE* nss_mtl_group = NULL;
-static nss_mtl_config_t* nss_mtl_config = NULL;
-static nss_mtl_utils_list_t* nss_mtl_active_users = NULL;
-static char nss_mtl_current_user[LOGIN_NAME_MAX + 1] = { '\0' };
+static long nss_mtl_now(void);
+static nss_mtl_grent_t* nss_mtl_grent_build(const nss_mtl_config_t* config, const nss_mtl_session_t* session, const nss_mtl_group_t* index, const char* session_user);
+static void nss_mtl_grent_destroy(nss_mtl_snapshot_t* snapshot);
+static const nss_mtl_grent_t* nss_mtl_grent_acquire(const char* session_user);
+static void nss_mtl_grent_release(const nss_mtl_grent_t* grent);
+static enum nss_status nss_mtl_grent_open(void);
+static enum nss_status nss_mtl_grent_read(struct group* grp, char* buffer, size_t buflen, int* errnop);
+
+/* glibc serializes enumeration, the lock only protects callers using the module directly */
+static pthread_mutex_t nss_mtl_grent_lock = PTHREAD_MUTEX_INITIALIZER;
+static const nss_mtl_grent_t* nss_mtl_grent = NULL;
+static size_t nss_mtl_grent_cursor = 0;
+static nss_mtl_snapshot_slot_t nss_mtl_grent_slot = NSS_MTL_SNAPSHOT_SLOT_INIT;
+static _Thread_local char nss_mtl_current_user[LOGIN_NAME_MAX + 1] = { '\0' };
+static nss_mtl_snapshot_slot_t nss_mtl_profiles_slot = NSS_MTL_SNAPSHOT_SLOT_INIT;
+static _Thread_local nss_mtl_group_memo_t nss_mtl_group_memo;
+static _Thread_local nss_mtl_decision_t nss_mtl_decision;
 
 /* implementation */
 
 char* nss_mtl_alloc_static(char** buffer, size_t* buflen, size_t size) {
 	if (buffer == NULL || buflen == NULL || *buflen < size) {
-		nss_mtl_utils_log(LOG_WARNING, "%s: cannot allocate buffer of size %ld", __func__, size);
+		nss_mtl_utils_log_limited(NSS_MTL_UTILS_LOG_ERANGE, LOG_WARNING, "%s: cannot allocate buffer of size %ld", __func__, size);
 		return NULL;
 	}
 
@@ -80,97 +199,178 @@ bool nss_mtl_user_ignored(const nss_mtl_config_t* config, const char* name) {
 	assert(config != NULL);
 	assert(name != NULL);
 
-	if (strcmp(config->target_user, name) == 0) {
+	size_t target = 0;
+	if (nss_mtl_config_target_find(config, name, &target)) {
 		return true;
 	}
 
-	const nss_mtl_utils_list_t* ignored = config->ignored_users;
-	if (bsearch(&name, ignored->items, ignored->filled, sizeof(char*), nss_mtl_utils_strptr_cmp) != NULL) {
+	if (nss_mtl_config_names_match(&config->ignored_users, name)) {
 		return true;
 	}
 
-	FILE* f = fopen(NSS_MTL_PASSWD_FILE, "r");
-	struct passwd* entry = NULL;
-	while ((entry = fgetpwent(f)) != NULL) {
-		if (entry->pw_name == NULL) {
-			nss_mtl_utils_log(LOG_WARNING, "%s: found empty username in passwd file", __func__);
-			continue;
-		}
-		if (strcmp(entry->pw_name, name) == 0) {
-			nss_mtl_utils_log(LOG_DEBUG, "%s: ignoring local user %s", __func__, name);
-			break;
-		}
+	const nss_mtl_passwd_t* passwd = nss_mtl_passwd_acquire();
+	if (passwd == NULL) {
+		/* cannot tell local users apart, so stay on the safe side */
+		return true;
 	}
 
-	fclose(f);
+	const bool local = nss_mtl_passwd_contains(passwd, name);
+	if (local) {
+		nss_mtl_utils_log(LOG_DEBUG, "%s: ignoring local user %s", __func__, name);
+	}
+	nss_mtl_passwd_release(passwd);
 
-	return entry != NULL;
+	return local;
 }
 
 bool nss_mtl_exec_ignored(const nss_mtl_config_t* config, const char* name) {
 	assert(config != NULL);
+	assert(name != NULL);
 
-	const nss_mtl_utils_list_t* ignored = config->ignored_execs;
-	return bsearch(&name, ignored->items, ignored->filled, sizeof(char*), nss_mtl_utils_strptr_cmp) != NULL;
+	return nss_mtl_config_names_match(&config->ignored_execs, name);
 }
 
-char* nss_mtl_parent_dir(const char* path) {
+size_t nss_mtl_parent_dir_length(const nss_mtl_utils_span_t* path) {
 	assert(path != NULL);
 
-	char* last_slash = strrchr(path, '/');
+	const char* last_slash = memrchr(path->start, '/', path->length);
 	if (last_slash == NULL) {
-		return strdup(path);
+		return path->length;
 	} else {
-		return strndup(path, last_slash - path);
+		return last_slash - path->start;
 	}
 }
 
-nss_mtl_user_info_t* nss_mtl_user_info_read(const char* name) {
+nss_mtl_user_info_t* nss_mtl_user_info_read(const nss_mtl_passwd_t* passwd, const char* name, nss_mtl_arena_t* arena) {
+	assert(passwd != NULL);
 	assert(name != NULL);
 
-	FILE* f = fopen(NSS_MTL_PASSWD_FILE, "r");
-	if (f == NULL) {
-		nss_mtl_utils_log(LOG_ERR, "%s: failed to open %s for reading: %m", __func__, NSS_MTL_PASSWD_FILE);
+	nss_mtl_passwd_record_t record;
+	if (! nss_mtl_passwd_find(passwd, name, &record)) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: user %s not found in %s file", __func__, name, NSS_MTL_PASSWD_FILE);
 		return NULL;
 	}
 
-	nss_mtl_user_info_t* info = NULL;
-	struct passwd* entry = NULL;
-	while ((entry = fgetpwent(f)) != NULL) {
-		if (entry->pw_name == NULL) {
-			nss_mtl_utils_log(LOG_WARNING, "%s: found empty username in passwd file", __func__);
-			continue;
-		}
-		if (strcmp(entry->pw_name, name) == 0) {
-			info = malloc(sizeof(nss_mtl_user_info_t));
-			if (info == NULL) {
-				nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for user info: %m", __func__);
-				return NULL;
-			}
-			info->uid = entry->pw_uid;
-			info->gid = entry->pw_gid;
-			info->gecos = strdup(entry->pw_gecos);
-			info->homedir_root = nss_mtl_parent_dir(entry->pw_dir);
-			info->shell = strdup(entry->pw_shell);
+	const size_t homedir_root_length = nss_mtl_parent_dir_length(&record.dir);
+	const size_t size = sizeof("x") + record.gecos.length + 1 + record.shell.length + 1 + homedir_root_length;
+	nss_mtl_user_info_t* info = nss_mtl_arena_alloc(arena, sizeof(nss_mtl_user_info_t) + size);
+	if (info == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for user info", __func__);
+		return NULL;
+	}
+	info->uid = record.uid;
+	info->gid = record.gid;
+	info->size = size;
+
+	char* pos = info->blob;
+	memcpy(pos, "x", sizeof("x"));
+	pos += sizeof("x");
+
+	info->gecos_offset = pos - info->blob;
+	memcpy(pos, record.gecos.start, record.gecos.length);
+	pos += record.gecos.length;
+	*pos++ = '\0';
 
-			break;
+	info->shell_offset = pos - info->blob;
+	memcpy(pos, record.shell.start, record.shell.length);
+	pos += record.shell.length;
+	*pos++ = '\0';
+
+	info->homedir_offset = pos - info->blob;
+	memcpy(pos, record.dir.start, homedir_root_length);
+
+	return info;
+}
+
+nss_mtl_profiles_t* nss_mtl_profiles_load(const nss_mtl_config_t* config, const nss_mtl_passwd_t* passwd) {
+	nss_mtl_arena_t* arena = nss_mtl_arena_create(NSS_MTL_PROFILES_ARENA_SIZE(config->targets_count));
+	nss_mtl_profiles_t* profiles = arena != NULL ? nss_mtl_arena_calloc(arena, 1, sizeof(nss_mtl_profiles_t)) : NULL;
+	if (profiles == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate target user profiles", __func__);
+		nss_mtl_arena_destroy(arena);
+		return NULL;
+	}
+	nss_mtl_snapshot_init(&profiles->snapshot, nss_mtl_profiles_destroy);
+	profiles->arena = arena;
+	profiles->config_generation = config->snapshot.generation;
+	profiles->passwd_generation = passwd->snapshot.generation;
+
+	/* missing target fails only the users mapped onto it */
+	for (size_t target = 0; target < config->targets_count; ++target) {
+		profiles->infos[target] = nss_mtl_user_info_read(passwd, config->targets[target], arena);
+	}
+
+	return profiles;
+}
+
+void nss_mtl_profiles_destroy(nss_mtl_snapshot_t* snapshot) {
+	nss_mtl_arena_destroy(((nss_mtl_profiles_t*)snapshot)->arena);
+}
+
+const nss_mtl_profiles_t* nss_mtl_profiles_acquire(const nss_mtl_config_t* config) {
+	assert(config != NULL);
+
+	const nss_mtl_passwd_t* passwd = nss_mtl_passwd_acquire();
+	if (passwd == NULL) {
+		return NULL;
+	}
+
+	nss_mtl_profiles_t* profiles = (nss_mtl_profiles_t*)nss_mtl_snapshot_acquire(&nss_mtl_profiles_slot);
+	if (profiles != NULL) {
+		if (profiles->config_generation == config->snapshot.generation && profiles->passwd_generation == passwd->snapshot.generation) {
+			nss_mtl_passwd_release(passwd);
+			return profiles;
 		}
+		nss_mtl_profiles_release(profiles);
 	}
 
-	if (info == NULL) {
-		nss_mtl_utils_log(LOG_WARNING, "%s: user %s not found in %s file", __func__, name, NSS_MTL_PASSWD_FILE);
+	profiles = nss_mtl_profiles_load(config, passwd);
+	nss_mtl_passwd_release(passwd);
+	if (profiles == NULL) {
+		return NULL;
 	}
+	nss_mtl_snapshot_publish(&nss_mtl_profiles_slot, &profiles->snapshot);
 
-	return info;
+	return profiles;
 }
 
-void nss_mtl_user_info_free(nss_mtl_user_info_t* info) {
-	assert(info != NULL);
+void nss_mtl_profiles_release(const nss_mtl_profiles_t* profiles) {
+	if (profiles != NULL) {
+		nss_mtl_snapshot_release((nss_mtl_snapshot_t*)&profiles->snapshot);
+	}
+}
 
-	free(info->gecos);
-	free(info->homedir_root);
-	free(info->shell);
-	free(info);
+void nss_mtl_decision_store(const nss_mtl_caller_t* caller, const nss_mtl_config_t* config, const char* name, bool ignored) {
+	const size_t name_size = strlen(name) + 1;
+	const size_t exec_size = strlen(caller->exec) + 1;
+	if (name_size > sizeof(nss_mtl_decision.name) || exec_size > sizeof(nss_mtl_decision.exec)) {
+		nss_mtl_decision.name[0] = '\0';
+		return;
+	}
+
+	memcpy(nss_mtl_decision.name, name, name_size);
+	memcpy(nss_mtl_decision.exec, caller->exec, exec_size);
+	nss_mtl_decision.config_generation = config->snapshot.generation;
+	nss_mtl_decision.created = nss_mtl_now();
+	nss_mtl_decision.ignored = ignored;
+}
+
+const nss_mtl_config_t* nss_mtl_decision_find(const nss_mtl_caller_t* caller, const char* name, bool* ignored) {
+	/* empty name never matches, so an unset record needs no check of its own */
+	if (strcmp(nss_mtl_decision.name, name) != 0 || strcmp(nss_mtl_decision.exec, caller->exec) != 0
+		|| nss_mtl_now() - nss_mtl_decision.created > NSS_MTL_DECISION_TTL) {
+		return NULL;
+	}
+
+	/* config reloaded by another thread in the meantime may decide otherwise */
+	const nss_mtl_config_t* config = nss_mtl_config_acquire_loaded();
+	if (config != NULL && config->snapshot.generation != nss_mtl_decision.config_generation) {
+		nss_mtl_config_release(config);
+		return NULL;
+	}
+
+	*ignored = nss_mtl_decision.ignored;
+	return config;
 }
 
 long nss_mtl_today() {
@@ -180,97 +380,100 @@ long nss_mtl_today() {
 	return t / (60 * 60 * 24);
 }
 
-enum nss_status _nss_mtl_getpwnam_r(const char* name, struct passwd* pw, char* buffer, size_t buflen, int* errnop) {
-	nss_mtl_config_t* config = nss_mtl_config_parse(NULL);
+long nss_mtl_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec;
+}
+
+enum nss_status nss_mtl_lookup_pwnam(const nss_mtl_caller_t* caller, const char* name, struct passwd* pw, char* buffer, size_t buflen, int* errnop) {
+	const nss_mtl_config_t* config = nss_mtl_config_acquire();
 	if (config == NULL) {
 		*errnop = ENOENT;
 		return NSS_STATUS_UNAVAIL;
 	}
-	nss_mtl_utils_log_setup(config->log_level);
+	nss_mtl_utils_log_setup(config->log_level, config->log_rate_limit);
 
 	nss_mtl_utils_log(LOG_DEBUG, "%s: querying %s", __func__, name);
 
-	if (nss_mtl_user_ignored(config, name) || nss_mtl_exec_ignored(config, program_invocation_short_name)) {
-		nss_mtl_utils_log(LOG_INFO, "%s: ignoring query for user %s from exec %s", __func__, name, program_invocation_short_name);
-		nss_mtl_config_free(config);
+	const bool ignored = nss_mtl_user_ignored(config, name) || nss_mtl_exec_ignored(config, caller->exec);
+	nss_mtl_decision_store(caller, config, name, ignored);
+	if (ignored) {
+		nss_mtl_utils_log_limited(NSS_MTL_UTILS_LOG_IGNORED, LOG_INFO, "%s: ignoring query for user %s from exec %s", __func__, name, caller->exec);
+		nss_mtl_config_release(config);
 		*errnop = ENOENT;
 		return NSS_STATUS_UNAVAIL;
 	}
 
-	nss_mtl_user_info_t* target_user = nss_mtl_user_info_read(config->target_user);
-	if (target_user == NULL) {
-		nss_mtl_config_free(config);
+	const nss_mtl_profiles_t* profiles = nss_mtl_profiles_acquire(config);
+	if (profiles == NULL) {
+		nss_mtl_config_release(config);
 		*errnop = ENOENT;
 		return NSS_STATUS_UNAVAIL;
 	}
 
-	pw->pw_name = nss_mtl_alloc_static(&buffer, &buflen, strlen(name) + 1);
-	if (pw->pw_name == NULL) {
-		goto bufsize_err;
-	} else {
-		strcpy(pw->pw_name, name);
+	const size_t target = nss_mtl_config_target(config, name);
+	const nss_mtl_user_info_t* target_user = profiles->infos[target];
+	if (target_user == NULL) {
+		nss_mtl_utils_log(LOG_DEBUG, "%s: target user %s of %s is not available", __func__, config->targets[target], name);
+		nss_mtl_profiles_release(profiles);
+		nss_mtl_config_release(config);
+		*errnop = ENOENT;
+		return NSS_STATUS_UNAVAIL;
 	}
 
-	pw->pw_passwd = nss_mtl_alloc_static(&buffer, &buflen, sizeof(char) * 2);
-	if (pw->pw_passwd == NULL) {
-		goto bufsize_err;
-	} else {
-		strcpy(pw->pw_passwd, "x");
+	/* name, prepacked blob, then "/<name>" appended to homedir root */
+	const size_t name_size = strlen(name) + 1;
+	if (buflen < name_size + target_user->size + 1 + name_size) {
+		nss_mtl_utils_log_limited(NSS_MTL_UTILS_LOG_ERANGE, LOG_WARNING, "%s: cannot allocate buffer of size %ld", __func__, name_size + target_user->size + 1 + name_size);
+		*errnop = ERANGE;
+		nss_mtl_config_release(config);
+		nss_mtl_profiles_release(profiles);
+		return NSS_STATUS_TRYAGAIN;
 	}
 
-	pw->pw_uid = target_user->uid;
-	pw->pw_gid = target_user->gid;
-
-	pw->pw_gecos = nss_mtl_alloc_static(&buffer, &buflen, strlen(target_user->gecos) + 1);
-	if (pw->pw_gecos == NULL) {
-		goto bufsize_err;
-	} else {
-		strcpy(pw->pw_gecos, target_user->gecos);
-	}
+	pw->pw_name = memcpy(buffer, name, name_size);
+	buffer += name_size;
 
-	const size_t homedir_size = strlen(target_user->homedir_root) + strlen(name) + 2;
-	pw->pw_dir = nss_mtl_alloc_static(&buffer, &buflen, homedir_size);
-	if (pw->pw_dir == NULL) {
-		goto bufsize_err;
-	} else {
-		snprintf(pw->pw_dir, homedir_size, "%s/%s", target_user->homedir_root, name);
-	}
+	memcpy(buffer, target_user->blob, target_user->size);
+	pw->pw_passwd = buffer;
+	pw->pw_gecos = buffer + target_user->gecos_offset;
+	pw->pw_shell = buffer + target_user->shell_offset;
+	pw->pw_dir = buffer + target_user->homedir_offset;
+	buffer += target_user->size;
 
-	pw->pw_shell = nss_mtl_alloc_static(&buffer, &buflen, strlen(target_user->shell) + 1);
-	if (pw->pw_shell == NULL) {
-		goto bufsize_err;
-	} else {
-		strcpy(pw->pw_shell, target_user->shell);
-	}
+	*buffer++ = '/';
+	memcpy(buffer, name, name_size);
 
-	/* store last used argument to properly assign groups for non-local users during login procedure */
-	nss_mtl_utils_log(LOG_DEBUG, "%s: storing session user %s", __func__, name);
-	strncpy(nss_mtl_current_user, name, LOGIN_NAME_MAX);
+	pw->pw_uid = target_user->uid;
+	pw->pw_gid = target_user->gid;
 
-	nss_mtl_config_free(config);
-	nss_mtl_user_info_free(target_user);
+	nss_mtl_config_release(config);
+	nss_mtl_profiles_release(profiles);
 	return NSS_STATUS_SUCCESS;
-
-	bufsize_err:
-	*errnop = ERANGE;
-	nss_mtl_config_free(config);
-	nss_mtl_user_info_free(target_user);
-	return NSS_STATUS_TRYAGAIN;
 }
 
-enum nss_status _nss_mtl_getspnam_r(const char* name, struct spwd* spw, char* buffer, size_t buflen, int* errnop) {
-	nss_mtl_config_t* config = nss_mtl_config_parse(NULL);
-	if (config == NULL) {
-		*errnop = ENOENT;
-		return NSS_STATUS_UNAVAIL;
-	}
-	nss_mtl_utils_log_setup(config->log_level);
+enum nss_status nss_mtl_lookup_spnam(const nss_mtl_caller_t* caller, const char* name, struct spwd* spw, char* buffer, size_t buflen, int* errnop) {
+	/* usually follows getpwnam for the same name, which already decided */
+	bool ignored = false;
+	const nss_mtl_config_t* config = nss_mtl_decision_find(caller, name, &ignored);
+	if (config != NULL) {
+		nss_mtl_utils_log(LOG_DEBUG, "%s: querying %s, decided by getpwnam", __func__, name);
+	} else {
+		config = nss_mtl_config_acquire();
+		if (config == NULL) {
+			*errnop = ENOENT;
+			return NSS_STATUS_UNAVAIL;
+		}
+		nss_mtl_utils_log_setup(config->log_level, config->log_rate_limit);
 
-	nss_mtl_utils_log(LOG_DEBUG, "%s: querying %s", __func__, name);
+		nss_mtl_utils_log(LOG_DEBUG, "%s: querying %s", __func__, name);
+		ignored = nss_mtl_user_ignored(config, name) || nss_mtl_exec_ignored(config, caller->exec);
+	}
 
-	if (nss_mtl_user_ignored(config, name) || nss_mtl_exec_ignored(config, program_invocation_short_name)) {
-		nss_mtl_utils_log(LOG_INFO, "%s: ignoring query for user %s from %s", __func__, name, program_invocation_short_name);
-		nss_mtl_config_free(config);
+	if (ignored) {
+		nss_mtl_utils_log_limited(NSS_MTL_UTILS_LOG_IGNORED, LOG_INFO, "%s: ignoring query for user %s from exec %s", __func__, name, caller->exec);
+		nss_mtl_config_release(config);
 		*errnop = ENOENT;
 		return NSS_STATUS_UNAVAIL;
 	}
@@ -296,252 +499,745 @@ enum nss_status _nss_mtl_getspnam_r(const char* name, struct spwd* spw, char* bu
 	spw->sp_inact = LONG_MAX;
 	spw->sp_expire = today + 1;
 
+	nss_mtl_config_release(config);
 	return NSS_STATUS_SUCCESS;
 
 	bufsize_err:
 	*errnop = ERANGE;
-	nss_mtl_config_free(config);
+	nss_mtl_config_release(config);
 	return NSS_STATUS_TRYAGAIN;
 }
 
 enum nss_status _nss_mtl_setgrent(void) {
-	if (nss_mtl_config == NULL) {
-		nss_mtl_config = nss_mtl_config_parse(NULL);
-		if (nss_mtl_config == NULL) {
+	NSS_MTL_PROBE(setgrent_entry);
+	pthread_mutex_lock(&nss_mtl_grent_lock);
+	nss_mtl_group_memo_clear();
+	/* pick up changes made since previous enumeration */
+	nss_mtl_grent_release(nss_mtl_grent);
+	nss_mtl_grent = NULL;
+	enum nss_status status = nss_mtl_grent_open();
+	pthread_mutex_unlock(&nss_mtl_grent_lock);
+
+	NSS_MTL_PROBE1(setgrent_return, status);
+	return status;
+}
+
+enum nss_status nss_mtl_grent_open(void) {
+	if (nss_mtl_grent == NULL) {
+		nss_mtl_grent = nss_mtl_grent_acquire(nss_mtl_current_user);
+		if (nss_mtl_grent == NULL) {
 			return NSS_STATUS_UNAVAIL;
 		}
-		nss_mtl_utils_log_setup(nss_mtl_config->log_level);
 	}
-	if (nss_mtl_active_users == NULL) {
-		nss_mtl_active_users = nss_mtl_utils_users_get();
-		if (nss_mtl_active_users == NULL) {
-			nss_mtl_utils_log(LOG_ERR, "%s: failed to acquire active users list", __func__);
-			return NSS_STATUS_UNAVAIL;
+	nss_mtl_grent_cursor = 0;
+
+	return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status _nss_mtl_endgrent(void) {
+	NSS_MTL_PROBE(endgrent_entry);
+	pthread_mutex_lock(&nss_mtl_grent_lock);
+	nss_mtl_group_memo_clear();
+
+	nss_mtl_grent_release(nss_mtl_grent);
+	nss_mtl_grent = NULL;
+	nss_mtl_grent_cursor = 0;
+
+	pthread_mutex_unlock(&nss_mtl_grent_lock);
+	NSS_MTL_PROBE1(endgrent_return, NSS_STATUS_SUCCESS);
+	return NSS_STATUS_SUCCESS;
+}
+
+void nss_mtl_group_expansion_init(const nss_mtl_config_t* config, const nss_mtl_session_t* session, const char* session_user, const struct group* src, nss_mtl_group_expansion_t* expansion) {
+	expansion->targets = 0;
+	expansion->extra_user = NULL;
+	expansion->extra_target = 0;
+
+	size_t target = 0;
+	for (size_t i = 0; src->gr_mem[i] != NULL; ++i) {
+		if (nss_mtl_config_target_find(config, src->gr_mem[i], &target)) {
+			expansion->targets |= UINT64_C(1) << target;
 		}
 	}
+	if (expansion->targets == 0) {
+		return;
+	}
 
-	if (nss_mtl_group == NULL) {
-		nss_mtl_group = fopen(NSS_MTL_GROUP_FILE, "r");
-		if (nss_mtl_group == NULL) {
-			nss_mtl_utils_log(LOG_ERR, "%s: failed to open %s for reading", __func__, NSS_MTL_GROUP_FILE);
-			nss_mtl_utils_list_free(nss_mtl_active_users);
-			nss_mtl_active_users = NULL;
-			return NSS_STATUS_UNAVAIL;
-		}
-		if (fcntl(fileno(nss_mtl_group), F_SETFD, FD_CLOEXEC) == -1) {
-			nss_mtl_utils_log(LOG_WARNING, "%s: failed to modify file descriptor: %m", __func__);
-			/* this is not critical, so we can continue */
+	/* user of calling session is appended to active ones of its target, unless already there */
+	if (session_user == NULL || session_user[0] == '\0' || nss_mtl_session_contains(session, session_user)) {
+		return;
+	}
+	target = nss_mtl_config_target(config, session_user);
+	if (expansion->targets & (UINT64_C(1) << target)) {
+		expansion->extra_user = session_user;
+		expansion->extra_target = target;
+	}
+}
+
+uint64_t nss_mtl_group_targets(const nss_mtl_config_t* config, const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry) {
+	/* member list is searched for target names as a whole, without splitting it */
+	nss_mtl_utils_span_t members;
+	nss_mtl_group_entry_members(index, entry, &members);
+
+	uint64_t targets = 0;
+	for (size_t target = 0; target < config->targets_count; ++target) {
+		if (nss_mtl_utils_span_has_item(&members, ',', config->targets[target], strlen(config->targets[target]))) {
+			targets |= UINT64_C(1) << target;
 		}
-	} else {
-		rewind(nss_mtl_group);
 	}
 
-	return NSS_STATUS_SUCCESS;
+	return targets;
 }
 
-enum nss_status _nss_mtl_endgrent(void) {
-	if (nss_mtl_group != NULL) {
-		fclose(nss_mtl_group);
-		nss_mtl_group = NULL;
+bool nss_mtl_group_member_duplicate(const nss_mtl_session_t* session, const nss_mtl_group_expansion_t* expansion, const char* member) {
+	/* only users brought in by one of the expanded targets are duplicates */
+	size_t target = 0;
+	if (nss_mtl_session_target(session, member, &target)) {
+		return expansion->targets & (UINT64_C(1) << target);
 	}
 
-	if (nss_mtl_active_users != NULL) {
-		nss_mtl_utils_list_free(nss_mtl_active_users);
-		nss_mtl_active_users = NULL;
-	}
+	return expansion->extra_user != NULL && strcmp(member, expansion->extra_user) == 0;
+}
+
+size_t nss_mtl_group_adapt_size(const nss_mtl_config_t* config, const nss_mtl_session_t* session, const char* session_user, const struct group* src) {
+	assert(config != NULL);
+	assert(session != NULL);
+	assert(src != NULL);
 
-	if (nss_mtl_config != NULL) {
-		nss_mtl_config_free(nss_mtl_config);
-		nss_mtl_config = NULL;
+	nss_mtl_group_expansion_t expansion;
+	nss_mtl_group_expansion_init(config, session, session_user, src, &expansion);
+
+	size_t size = strlen(src->gr_name) + 1 + strlen(src->gr_passwd) + 1;
+	size_t count = 0;
+	size_t target = 0;
+	for (size_t i = 0; src->gr_mem[i] != NULL; ++i) {
+		if (expansion.targets != 0 && nss_mtl_config_target_find(config, src->gr_mem[i], &target)) {
+			count += session->blocks[target].count;
+			size += session->blocks[target].block_size;
+			if (expansion.extra_user != NULL && expansion.extra_target == target) {
+				count += 1;
+				size += strlen(expansion.extra_user) + 1;
+			}
+		}
+		if (expansion.targets != 0 && nss_mtl_group_member_duplicate(session, &expansion, src->gr_mem[i])) {
+			continue;
+		}
+		count += 1;
+		size += strlen(src->gr_mem[i]) + 1;
 	}
 
-	return NSS_STATUS_SUCCESS;
+	return (count + 1) * sizeof(char*) + size;
 }
 
-bool nss_mtl_group_adapt(nss_mtl_config_t* config, nss_mtl_utils_list_t* active_users, struct group* dst, const struct group* src, char* buffer, size_t buflen) {
+size_t nss_mtl_group_adapt_padding(const char* buffer) {
+	/* member array goes first and has to be aligned */
+	return -(uintptr_t)buffer & (_Alignof(char*) - 1);
+}
+
+void nss_mtl_group_adapt(const nss_mtl_config_t* config, const nss_mtl_session_t* session, const char* session_user, struct group* dst, const struct group* src, char* buffer) {
 	assert(config != NULL);
-	assert(active_users != NULL);
+	assert(session != NULL);
 	assert(dst != NULL);
 	assert(src != NULL);
 	assert(buffer != NULL);
 
-	dst->gr_name = nss_mtl_alloc_static(&buffer, &buflen, strlen(src->gr_name) + 1);
-	if (dst->gr_name == NULL) {
-		return false;
-	} else {
-		strcpy(dst->gr_name, src->gr_name);
-	}
+	/* buffer is already checked against nss_mtl_group_adapt_size(), so nothing can fail here */
+	NSS_MTL_PROBE2(group_adapt_entry, src->gr_name, src->gr_gid);
+	buffer += nss_mtl_group_adapt_padding(buffer);
 
-	dst->gr_passwd = nss_mtl_alloc_static(&buffer, &buflen, strlen(src->gr_passwd) + 1);
-	if (dst->gr_passwd == NULL) {
-		return false;
-	} else {
-		strcpy(dst->gr_passwd, src->gr_passwd);
-	}
-
-	dst->gr_gid = src->gr_gid;
+	nss_mtl_group_expansion_t expansion;
+	nss_mtl_group_expansion_init(config, session, session_user, src, &expansion);
 
 	size_t msize = 0;
-	bool has_target_user = false;
-	while (src->gr_mem[msize] != NULL) {
-		if (strcmp(src->gr_mem[msize], config->target_user) == 0) {
-			has_target_user = true;
+	size_t target_msize = 1;
+	size_t target = 0;
+	for (; src->gr_mem[msize] != NULL; ++msize) {
+		if (expansion.targets != 0 && nss_mtl_config_target_find(config, src->gr_mem[msize], &target)) {
+			target_msize += session->blocks[target].count + (expansion.extra_user != NULL && expansion.extra_target == target ? 1 : 0);
+		}
+		if (expansion.targets == 0 || ! nss_mtl_group_member_duplicate(session, &expansion, src->gr_mem[msize])) {
+			++target_msize;
 		}
-		++msize;
 	}
+	dst->gr_mem = (char**)buffer;
+	buffer += target_msize * sizeof(char*);
 
-	bool add_current_user = has_target_user && (strlen(nss_mtl_current_user) > 0);
-	const size_t target_msize = msize + (has_target_user ? active_users->filled : 0) + (add_current_user ? 1 : 0) + 1;
-	dst->gr_mem = (char**)nss_mtl_alloc_static(&buffer, &buflen, target_msize * sizeof(char*));
-	if (dst->gr_mem == NULL) {
-		return false;
-	}
-	memset(dst->gr_mem, 0, target_msize * sizeof(char*));
+	dst->gr_name = buffer;
+	buffer = stpcpy(buffer, src->gr_name) + 1;
+	dst->gr_passwd = buffer;
+	buffer = stpcpy(buffer, src->gr_passwd) + 1;
+	dst->gr_gid = src->gr_gid;
 
-	int idx = 0;
+	size_t idx = 0;
 	for (size_t i = 0; i < msize; ++i) {
-		if (strcmp(src->gr_mem[i], config->target_user) == 0) {
-			nss_mtl_utils_log(LOG_DEBUG, "%s: found %s as group %s member, extending with active users", __func__, config->target_user, src->gr_name);
-			for (size_t k = 0; k < active_users->filled; ++k) {
-				dst->gr_mem[idx] = nss_mtl_alloc_static(&buffer, &buflen, strlen(active_users->items[k]) + 1);
-				if (dst->gr_mem[idx] == NULL) {
-					return false;
-				} else {
-					strcpy(dst->gr_mem[idx++], active_users->items[k]);
-				}
+		if (expansion.targets != 0 && nss_mtl_config_target_find(config, src->gr_mem[i], &target)) {
+			nss_mtl_utils_log(LOG_DEBUG, "%s: found %s as group %s member, extending with its active users", __func__, src->gr_mem[i], src->gr_name);
+			/* prepacked names are copied at once, only pointers are set one by one */
+			const nss_mtl_session_block_t* block = &session->blocks[target];
+			memcpy(buffer, block->block, block->block_size);
+			for (size_t k = 0; k < block->count; ++k) {
+				dst->gr_mem[idx++] = buffer + block->offsets[k];
 			}
-			if (add_current_user) {
-				dst->gr_mem[idx] = nss_mtl_alloc_static(&buffer, &buflen, strlen(nss_mtl_current_user) + 1);
-				if (dst->gr_mem[idx] == NULL) {
-					return false;
-				} else {
-					strcpy(dst->gr_mem[idx++], nss_mtl_current_user);
-				}
+			buffer += block->block_size;
+			if (expansion.extra_user != NULL && expansion.extra_target == target) {
+				dst->gr_mem[idx++] = buffer;
+				buffer = stpcpy(buffer, expansion.extra_user) + 1;
 			}
 		}
-		if (add_current_user && (strcmp(src->gr_mem[i], nss_mtl_current_user) == 0)) {
+		if (expansion.targets != 0 && nss_mtl_group_member_duplicate(session, &expansion, src->gr_mem[i])) {
 			/* avoid duplicates */
 			continue;
 		}
-		dst->gr_mem[idx] = nss_mtl_alloc_static(&buffer, &buflen, strlen(src->gr_mem[i]) + 1);
-		if (dst->gr_mem[idx] == NULL) {
-			return false;
-		} else {
-			strcpy(dst->gr_mem[idx++], src->gr_mem[i]);
+		dst->gr_mem[idx++] = buffer;
+		buffer = stpcpy(buffer, src->gr_mem[i]) + 1;
+	}
+	dst->gr_mem[idx] = NULL;
+	NSS_MTL_PROBE3(group_adapt_return, src->gr_name, src->gr_gid, idx);
+}
+
+enum nss_status nss_mtl_group_output(nss_mtl_group_memo_kind_t kind, const nss_mtl_config_t* config, const nss_mtl_session_t* session, const char* session_user, const struct group* src, struct group* grp, char* buffer, size_t buflen, int* errnop) {
+	const size_t size = nss_mtl_group_adapt_size(config, session, session_user, src);
+	if (buflen < nss_mtl_group_adapt_padding(buffer) + size) {
+		nss_mtl_utils_log(LOG_DEBUG, "%s: group %s needs buffer of size %lu", __func__, src->gr_name, size);
+		/* glibc retries with larger buffer right away, keep the result for it */
+		if (kind != NSS_MTL_GROUP_MEMO_NONE) {
+			nss_mtl_group_memo_store(kind, config, session, session_user, src, size);
 		}
+		*errnop = ERANGE;
+		return NSS_STATUS_TRYAGAIN;
+	}
+
+	nss_mtl_group_adapt(config, session, session_user, grp, src, buffer);
+	return NSS_STATUS_SUCCESS;
+}
+
+bool nss_mtl_group_image_copy(const struct group* src, const char* image, size_t size, struct group* grp, char* buffer, size_t buflen) {
+	const size_t padding = nss_mtl_group_adapt_padding(buffer);
+	if (buflen < padding + size) {
+		return false;
+	}
+
+	/* copy the image and move its pointers over to caller's buffer */
+	buffer += padding;
+	memcpy(buffer, image, size);
+	const ptrdiff_t delta = buffer - image;
+	grp->gr_name = src->gr_name + delta;
+	grp->gr_passwd = src->gr_passwd + delta;
+	grp->gr_gid = src->gr_gid;
+	grp->gr_mem = (char**)((char*)src->gr_mem + delta);
+	for (size_t i = 0; grp->gr_mem[i] != NULL; ++i) {
+		grp->gr_mem[i] += delta;
 	}
 
 	return true;
 }
 
-enum nss_status _nss_mtl_getgrent_r(struct group* grp, char* buffer, size_t buflen, int* errnop) {
-	if (nss_mtl_group == NULL || nss_mtl_active_users == NULL || nss_mtl_config == NULL) {
+void nss_mtl_group_memo_clear(void) {
+	free(nss_mtl_group_memo.image);
+	free(nss_mtl_group_memo.session_user);
+	memset(&nss_mtl_group_memo, 0, sizeof(nss_mtl_group_memo));
+}
+
+void nss_mtl_group_memo_store(nss_mtl_group_memo_kind_t kind, const nss_mtl_config_t* config, const nss_mtl_session_t* session, const char* session_user, const struct group* src, size_t size) {
+	nss_mtl_group_memo_clear();
+
+	char* image = malloc(size);
+	char* user = strdup(session_user != NULL ? session_user : "");
+	if (image == NULL || user == NULL) {
+		/* memo is only an optimization */
+		free(image);
+		free(user);
+		return;
+	}
+
+	/* malloc() result is aligned, so the image needs no padding */
+	nss_mtl_group_adapt(config, session, session_user, &nss_mtl_group_memo.grp, src, image);
+	nss_mtl_group_memo.kind = kind;
+	nss_mtl_group_memo.session_user = user;
+	nss_mtl_group_memo.image = image;
+	nss_mtl_group_memo.size = size;
+	nss_mtl_group_memo.created = nss_mtl_now();
+}
+
+bool nss_mtl_group_memo_take(nss_mtl_group_memo_kind_t kind, const char* name, gid_t gid, const char* session_user, struct group* grp, char* buffer, size_t buflen, int* errnop, enum nss_status* status) {
+	nss_mtl_group_memo_t* memo = &nss_mtl_group_memo;
+	if (memo->kind == NSS_MTL_GROUP_MEMO_NONE) {
+		return false;
+	}
+
+	bool match = memo->kind == kind && strcmp(memo->session_user, session_user != NULL ? session_user : "") == 0;
+	if (kind == NSS_MTL_GROUP_MEMO_NAME) {
+		match = match && strcmp(memo->grp.gr_name, name) == 0;
+	} else if (kind == NSS_MTL_GROUP_MEMO_GID) {
+		match = match && memo->grp.gr_gid == gid;
+	}
+	match = match && nss_mtl_now() - memo->created <= NSS_MTL_GROUP_MEMO_TTL;
+	if (! match) {
+		/* memo serves only the retry right after ERANGE */
+		nss_mtl_group_memo_clear();
+		return false;
+	}
+
+	if (! nss_mtl_group_image_copy(&memo->grp, memo->image, memo->size, grp, buffer, buflen)) {
+		*errnop = ERANGE;
+		*status = NSS_STATUS_TRYAGAIN;
+		return true;
+	}
+
+	nss_mtl_utils_log(LOG_DEBUG, "%s: served group %s from memo", __func__, grp->gr_name);
+	nss_mtl_group_memo_clear();
+	*status = NSS_STATUS_SUCCESS;
+	return true;
+}
+
+enum nss_status nss_mtl_group_reply(const nss_mtl_caller_t* caller, nss_mtl_group_memo_kind_t kind, const nss_mtl_config_t* config, const nss_mtl_session_t* session, const nss_mtl_group_t* index, const nss_mtl_group_entry_t* entry, struct group* grp, char* buffer, size_t buflen, int* errnop) {
+	/* groups listing no target are not adapted, so they are written straight from the line, retries included */
+	if (nss_mtl_group_targets(config, index, entry) == 0) {
+		const size_t size = nss_mtl_group_entry_image_size(index, entry);
+		const size_t padding = nss_mtl_group_adapt_padding(buffer);
+		if (buflen < padding + size) {
+			nss_mtl_utils_log(LOG_DEBUG, "%s: group %.*s needs buffer of size %lu", __func__, (int)entry->name_length, index->data + entry->offset, size);
+			*errnop = ERANGE;
+			return NSS_STATUS_TRYAGAIN;
+		}
+		nss_mtl_group_entry_image(index, entry, grp, buffer + padding);
+		return NSS_STATUS_SUCCESS;
+	}
+
+	struct group src;
+	char* storage = nss_mtl_group_entry_parse(index, entry, &src);
+	if (storage == NULL) {
+		*errnop = ENOMEM;
+		return NSS_STATUS_TRYAGAIN;
+	}
+
+	/* memo would stay behind on nss_mtld thread and never serve the retry */
+	if (caller->remote) {
+		kind = NSS_MTL_GROUP_MEMO_NONE;
+	}
+	enum nss_status status = nss_mtl_group_output(kind, config, session, caller->session_user, &src, grp, buffer, buflen, errnop);
+
+	free(storage);
+	return status;
+}
+
+nss_mtl_grent_t* nss_mtl_grent_build(const nss_mtl_config_t* config, const nss_mtl_session_t* session, const nss_mtl_group_t* index, const char* session_user) {
+	nss_mtl_grent_t* grent = calloc(1, sizeof(nss_mtl_grent_t));
+	if (grent == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate group enumeration: %m", __func__);
+		return NULL;
+	}
+	nss_mtl_snapshot_init(&grent->snapshot, nss_mtl_grent_destroy);
+	grent->config_generation = config->snapshot.generation;
+	grent->session_generation = session->snapshot.generation;
+	grent->group_generation = index->snapshot.generation;
+	grent->session_user = strdup(session_user);
+	grent->entries = calloc(index->count + 1, sizeof(nss_mtl_grent_entry_t));
+	if (grent->session_user == NULL || grent->entries == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for %lu groups", __func__, index->count);
+		nss_mtl_grent_destroy(&grent->snapshot);
+		return NULL;
+	}
+
+	/*
+	 * sizes go first, so that every image is adapted in place into a single buffer;
+	 * only groups listing a target are split into members, others are copied from their lines
+	 */
+	uint64_t* targets = malloc((index->count + 1) * sizeof(uint64_t));
+	if (targets == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for %lu groups", __func__, index->count);
+		nss_mtl_grent_destroy(&grent->snapshot);
+		return NULL;
+	}
+	struct group src;
+	size_t size = 0;
+	for (size_t i = 0; i < index->count; ++i) {
+		size = (size + _Alignof(char*) - 1) & ~(_Alignof(char*) - 1);
+		grent->entries[i].offset = size;
+		targets[i] = nss_mtl_group_targets(config, index, &index->entries[i]);
+		if (targets[i] == 0) {
+			grent->entries[i].size = nss_mtl_group_entry_image_size(index, &index->entries[i]);
+			size += grent->entries[i].size;
+			continue;
+		}
+		char* storage = nss_mtl_group_entry_parse(index, &index->entries[i], &src);
+		if (storage == NULL) {
+			free(targets);
+			nss_mtl_grent_destroy(&grent->snapshot);
+			return NULL;
+		}
+		grent->entries[i].size = nss_mtl_group_adapt_size(config, session, session_user, &src);
+		size += grent->entries[i].size;
+		free(storage);
+	}
+
+	grent->data = malloc(size + 1);
+	if (grent->data == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer of size %lu", __func__, size);
+		free(targets);
+		nss_mtl_grent_destroy(&grent->snapshot);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < index->count; ++i) {
+		if (targets[i] == 0) {
+			nss_mtl_group_entry_image(index, &index->entries[i], &grent->entries[i].grp, grent->data + grent->entries[i].offset);
+			++grent->count;
+			continue;
+		}
+		char* storage = nss_mtl_group_entry_parse(index, &index->entries[i], &src);
+		if (storage == NULL) {
+			free(targets);
+			nss_mtl_grent_destroy(&grent->snapshot);
+			return NULL;
+		}
+		nss_mtl_group_adapt(config, session, session_user, &grent->entries[i].grp, &src, grent->data + grent->entries[i].offset);
+		free(storage);
+		++grent->count;
+	}
+	free(targets);
+
+	nss_mtl_utils_log(LOG_DEBUG, "%s: adapted %lu groups into %lu bytes", __func__, grent->count, size);
+	return grent;
+}
+
+void nss_mtl_grent_destroy(nss_mtl_snapshot_t* snapshot) {
+	nss_mtl_grent_t* grent = (nss_mtl_grent_t*)snapshot;
+	free(grent->data);
+	free(grent->entries);
+	free(grent->session_user);
+	free(grent);
+}
+
+const nss_mtl_grent_t* nss_mtl_grent_acquire(const char* session_user) {
+	const nss_mtl_config_t* config = nss_mtl_config_acquire();
+	if (config == NULL) {
+		return NULL;
+	}
+	nss_mtl_utils_log_setup(config->log_level, config->log_rate_limit);
+
+	const nss_mtl_session_t* session = nss_mtl_session_acquire(config);
+	if (session == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: failed to acquire active users list", __func__);
+		nss_mtl_config_release(config);
+		return NULL;
+	}
+
+	const nss_mtl_group_t* index = nss_mtl_group_acquire();
+	if (index == NULL) {
+		nss_mtl_session_release(session);
+		nss_mtl_config_release(config);
+		return NULL;
+	}
+
+	nss_mtl_grent_t* grent = (nss_mtl_grent_t*)nss_mtl_snapshot_acquire(&nss_mtl_grent_slot);
+	if (grent != NULL) {
+		if (grent->config_generation != config->snapshot.generation
+			|| grent->session_generation != session->snapshot.generation
+			|| grent->group_generation != index->snapshot.generation
+			|| strcmp(grent->session_user, session_user) != 0) {
+			nss_mtl_grent_release(grent);
+			grent = NULL;
+		}
+	}
+
+	if (grent == NULL) {
+		grent = nss_mtl_grent_build(config, session, index, session_user);
+		if (grent != NULL) {
+			nss_mtl_snapshot_publish(&nss_mtl_grent_slot, &grent->snapshot);
+		}
+	}
+
+	nss_mtl_group_release(index);
+	nss_mtl_session_release(session);
+	nss_mtl_config_release(config);
+	return grent;
+}
+
+void nss_mtl_grent_release(const nss_mtl_grent_t* grent) {
+	if (grent != NULL) {
+		nss_mtl_snapshot_release((nss_mtl_snapshot_t*)&grent->snapshot);
+	}
+}
+
+enum nss_status nss_mtl_grent_read(struct group* grp, char* buffer, size_t buflen, int* errnop) {
+	pthread_mutex_lock(&nss_mtl_grent_lock);
+
+	enum nss_status status = NSS_STATUS_SUCCESS;
+	if (nss_mtl_grent == NULL) {
 		nss_mtl_utils_log(LOG_WARNING, "%s: group database not initialized", __func__);
-		enum nss_status status = _nss_mtl_setgrent();
+		status = nss_mtl_grent_open();
 		if (status != NSS_STATUS_SUCCESS) {
+			pthread_mutex_unlock(&nss_mtl_grent_lock);
 			return status;
 		}
 	}
 
-	const struct group* entry = fgetgrent(nss_mtl_group);
-	if (entry == NULL) {
-		return NSS_STATUS_NOTFOUND;
-	} else if (! nss_mtl_group_adapt(nss_mtl_config, nss_mtl_active_users, grp, entry, buffer, buflen)) {
-		*errnop = ERANGE;
-		return NSS_STATUS_TRYAGAIN;
+	if (nss_mtl_grent_cursor >= nss_mtl_grent->count) {
+		status = NSS_STATUS_NOTFOUND;
 	} else {
-		return NSS_STATUS_SUCCESS;
+		/* cursor moves only on success, so the retry after ERANGE gets the same entry */
+		const nss_mtl_grent_entry_t* entry = &nss_mtl_grent->entries[nss_mtl_grent_cursor];
+		if (nss_mtl_group_image_copy(&entry->grp, nss_mtl_grent->data + entry->offset, entry->size, grp, buffer, buflen)) {
+			++nss_mtl_grent_cursor;
+		} else {
+			nss_mtl_utils_log(LOG_DEBUG, "%s: group %s needs buffer of size %lu", __func__, entry->grp.gr_name, entry->size);
+			*errnop = ERANGE;
+			status = NSS_STATUS_TRYAGAIN;
+		}
 	}
+
+	pthread_mutex_unlock(&nss_mtl_grent_lock);
+	return status;
 }
 
-enum nss_status _nss_mtl_getgrnam_r(const char* name, struct group* grp, char* buffer, size_t buflen, int* errnop) {
-	nss_mtl_config_t* config = nss_mtl_config_parse(NULL);
+enum nss_status nss_mtl_lookup_grnam(const nss_mtl_caller_t* caller, const char* name, struct group* grp, char* buffer, size_t buflen, int* errnop) {
+	enum nss_status status = NSS_STATUS_NOTFOUND;
+	if (nss_mtl_group_memo_take(NSS_MTL_GROUP_MEMO_NAME, name, 0, caller->session_user, grp, buffer, buflen, errnop, &status)) {
+		return status;
+	}
+
+	const nss_mtl_config_t* config = nss_mtl_config_acquire();
 	if (config == NULL) {
 		*errnop = ENOENT;
 		return NSS_STATUS_UNAVAIL;
 	}
-	nss_mtl_utils_log_setup(config->log_level);
+	nss_mtl_utils_log_setup(config->log_level, config->log_rate_limit);
 
-	nss_mtl_utils_list_t* active_users = nss_mtl_utils_users_get();
-	if (active_users == NULL) {
-		nss_mtl_config_free(config);
+	const nss_mtl_session_t* session = nss_mtl_session_acquire(config);
+	if (session == NULL) {
+		nss_mtl_config_release(config);
 		*errnop = ENOENT;
 		return NSS_STATUS_UNAVAIL;
 	}
 
-	FILE* f = fopen(NSS_MTL_GROUP_FILE, "r");
-	if (f == NULL) {
-		nss_mtl_utils_log(LOG_ERR, "%s: failed to open %s for reading: %m", __func__, NSS_MTL_GROUP_FILE);
-		nss_mtl_config_free(config);
-		nss_mtl_utils_list_free(active_users);
+	const nss_mtl_group_t* index = nss_mtl_group_acquire();
+	if (index == NULL) {
+		nss_mtl_config_release(config);
+		nss_mtl_session_release(session);
 		*errnop = ENOENT;
 		return NSS_STATUS_UNAVAIL;
 	}
 
+	const nss_mtl_group_entry_t* entry = nss_mtl_group_find_name(index, name);
+	if (entry != NULL) {
+		status = nss_mtl_group_reply(caller, NSS_MTL_GROUP_MEMO_NAME, config, session, index, entry, grp, buffer, buflen, errnop);
+	}
+
+	nss_mtl_config_release(config);
+	nss_mtl_session_release(session);
+	nss_mtl_group_release(index);
+
+	return status;
+}
+
+enum nss_status nss_mtl_lookup_grgid(const nss_mtl_caller_t* caller, gid_t gid, struct group* grp, char* buffer, size_t buflen, int* errnop) {
 	enum nss_status status = NSS_STATUS_NOTFOUND;
+	if (nss_mtl_group_memo_take(NSS_MTL_GROUP_MEMO_GID, NULL, gid, caller->session_user, grp, buffer, buflen, errnop, &status)) {
+		return status;
+	}
 
-	const struct group* entry = NULL;
-	while ((entry = fgetgrent(f)) != NULL) {
-		if (strcmp(entry->gr_name, name) == 0) {
-			if (! nss_mtl_group_adapt(config, active_users, grp, entry, buffer, buflen)) {
-				*errnop = ERANGE;
-				status = NSS_STATUS_TRYAGAIN;
-			} else {
-				status = NSS_STATUS_SUCCESS;
-			}
-			break;
-		}
+	const nss_mtl_config_t* config = nss_mtl_config_acquire();
+	if (config == NULL) {
+		*errnop = ENOENT;
+		return NSS_STATUS_UNAVAIL;
 	}
+	nss_mtl_utils_log_setup(config->log_level, config->log_rate_limit);
 
-	fclose(f);
-	nss_mtl_config_free(config);
-	nss_mtl_utils_list_free(active_users);
+	const nss_mtl_session_t* session = nss_mtl_session_acquire(config);
+	if (session == NULL) {
+		nss_mtl_config_release(config);
+		*errnop = ENOENT;
+		return NSS_STATUS_UNAVAIL;
+	}
+
+	const nss_mtl_group_t* index = nss_mtl_group_acquire();
+	if (index == NULL) {
+		nss_mtl_config_release(config);
+		nss_mtl_session_release(session);
+		*errnop = ENOENT;
+		return NSS_STATUS_UNAVAIL;
+	}
+
+	const nss_mtl_group_entry_t* entry = nss_mtl_group_find_gid(index, gid);
+	if (entry != NULL) {
+		status = nss_mtl_group_reply(caller, NSS_MTL_GROUP_MEMO_GID, config, session, index, entry, grp, buffer, buflen, errnop);
+	}
+
+	nss_mtl_config_release(config);
+	nss_mtl_session_release(session);
+	nss_mtl_group_release(index);
 
 	return status;
 }
 
-enum nss_status _nss_mtl_getgrgid_r(gid_t gid, struct group* grp, char* buffer, size_t buflen, int* errnop) {
-	nss_mtl_config_t* config = nss_mtl_config_parse(NULL);
+enum nss_status nss_mtl_lookup_initgroups(const nss_mtl_caller_t* caller, const char* user, gid_t group, long int* start, long int* size, gid_t** groupsp, long int limit, int* errnop) {
+	const nss_mtl_config_t* config = nss_mtl_config_acquire();
 	if (config == NULL) {
 		*errnop = ENOENT;
 		return NSS_STATUS_UNAVAIL;
 	}
-	nss_mtl_utils_log_setup(config->log_level);
+	nss_mtl_utils_log_setup(config->log_level, config->log_rate_limit);
 
-	nss_mtl_utils_list_t* active_users = nss_mtl_utils_users_get();
-	if (active_users == NULL) {
-		nss_mtl_config_free(config);
+	nss_mtl_utils_log(LOG_DEBUG, "%s: querying %s", __func__, user);
+
+	if (nss_mtl_user_ignored(config, user) || nss_mtl_exec_ignored(config, caller->exec)) {
+		nss_mtl_utils_log_limited(NSS_MTL_UTILS_LOG_IGNORED, LOG_INFO, "%s: ignoring query for user %s from exec %s", __func__, user, caller->exec);
+		nss_mtl_config_release(config);
 		*errnop = ENOENT;
 		return NSS_STATUS_UNAVAIL;
 	}
 
-	FILE* f = fopen(NSS_MTL_GROUP_FILE, "r");
-	if (f == NULL) {
-		nss_mtl_utils_log(LOG_ERR, "%s: failed to open %s for reading: %m", __func__, NSS_MTL_GROUP_FILE);
-		nss_mtl_config_free(config);
-		nss_mtl_utils_list_free(active_users);
+	const nss_mtl_group_t* index = nss_mtl_group_acquire();
+	if (index == NULL) {
+		nss_mtl_config_release(config);
 		*errnop = ENOENT;
 		return NSS_STATUS_UNAVAIL;
 	}
 
-	enum nss_status status = NSS_STATUS_NOTFOUND;
+	/* remote users inherit all supplementary groups of their target user */
+	const nss_mtl_group_membership_t* membership = nss_mtl_group_membership_acquire(index, config->targets[nss_mtl_config_target(config, user)]);
+	nss_mtl_group_release(index);
+	nss_mtl_config_release(config);
+	if (membership == NULL) {
+		*errnop = ENOMEM;
+		return NSS_STATUS_TRYAGAIN;
+	}
 
-	const struct group* entry = NULL;
-	while ((entry = fgetgrent(f)) != NULL) {
-		if (entry->gr_gid == gid) {
-			if (! nss_mtl_group_adapt(config, active_users, grp, entry, buffer, buflen)) {
-				*errnop = ERANGE;
-				status = NSS_STATUS_TRYAGAIN;
-			} else {
-				status = NSS_STATUS_SUCCESS;
+	enum nss_status status = nss_mtl_lookup_groups_add(membership->gids, membership->count, group, start, size, groupsp, limit, errnop);
+	nss_mtl_group_membership_release(membership);
+	return status;
+}
+
+enum nss_status nss_mtl_lookup_groups_add(const gid_t* gids, size_t count, gid_t group, long int* start, long int* size, gid_t** groupsp, long int limit, int* errnop) {
+	gid_t* groups = *groupsp;
+	for (size_t i = 0; i < count; ++i) {
+		const gid_t gid = gids[i];
+		if (gid == group) {
+			continue;
+		}
+
+		bool present = false;
+		for (long int k = 0; k < *start && ! present; ++k) {
+			present = groups[k] == gid;
+		}
+		if (present) {
+			continue;
+		}
+
+		if (*start == *size) {
+			if (limit > 0 && *size == limit) {
+				/* caller does not want more groups */
+				break;
+			}
+			long int new_size = 2 * *size;
+			if (limit > 0 && new_size > limit) {
+				new_size = limit;
 			}
-			break;
+			gid_t* new_groups = realloc(groups, new_size * sizeof(gid_t));
+			if (new_groups == NULL) {
+				nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for %ld groups", __func__, new_size);
+				*errnop = ENOMEM;
+				return NSS_STATUS_TRYAGAIN;
+			}
+			*groupsp = groups = new_groups;
+			*size = new_size;
 		}
+
+		groups[(*start)++] = gid;
+	}
+
+	return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status _nss_mtl_getpwnam_r(const char* name, struct passwd* pw, char* buffer, size_t buflen, int* errnop) {
+	NSS_MTL_PROBE1(getpwnam_entry, name);
+	const uint64_t started = nss_mtl_stats_begin();
+	const nss_mtl_caller_t caller = { program_invocation_short_name, nss_mtl_current_user, false };
+
+	enum nss_status status = NSS_STATUS_UNAVAIL;
+	if (! nss_mtl_client_pwnam(&caller, name, pw, buffer, buflen, errnop, &status)) {
+		status = nss_mtl_lookup_pwnam(&caller, name, pw, buffer, buflen, errnop);
+	}
+
+	if (status == NSS_STATUS_SUCCESS) {
+		/* store last used argument to properly assign groups for non-local users during login procedure */
+		nss_mtl_utils_log(LOG_DEBUG, "%s: storing session user %s", __func__, name);
+		strncpy(nss_mtl_current_user, name, LOGIN_NAME_MAX);
 	}
 
-	fclose(f);
-	nss_mtl_config_free(config);
-	nss_mtl_utils_list_free(active_users);
+	nss_mtl_stats_record(NSS_MTL_STATS_GETPWNAM, started, nss_mtl_stats_result(status, *errnop), 0);
+	NSS_MTL_PROBE3(getpwnam_return, name, status, *errnop);
+	return status;
+}
+
+enum nss_status _nss_mtl_getspnam_r(const char* name, struct spwd* spw, char* buffer, size_t buflen, int* errnop) {
+	NSS_MTL_PROBE1(getspnam_entry, name);
+	const uint64_t started = nss_mtl_stats_begin();
+	const nss_mtl_caller_t caller = { program_invocation_short_name, nss_mtl_current_user, false };
+
+	enum nss_status status = NSS_STATUS_UNAVAIL;
+	if (! nss_mtl_client_spnam(&caller, name, spw, buffer, buflen, errnop, &status)) {
+		status = nss_mtl_lookup_spnam(&caller, name, spw, buffer, buflen, errnop);
+	}
+
+	nss_mtl_stats_record(NSS_MTL_STATS_GETSPNAM, started, nss_mtl_stats_result(status, *errnop), 0);
+	NSS_MTL_PROBE3(getspnam_return, name, status, *errnop);
+	return status;
+}
+
+enum nss_status _nss_mtl_getgrnam_r(const char* name, struct group* grp, char* buffer, size_t buflen, int* errnop) {
+	NSS_MTL_PROBE1(getgrnam_entry, name);
+	const uint64_t started = nss_mtl_stats_begin();
+	const nss_mtl_caller_t caller = { program_invocation_short_name, nss_mtl_current_user, false };
+
+	enum nss_status status = NSS_STATUS_UNAVAIL;
+	if (! nss_mtl_client_grnam(&caller, name, grp, buffer, buflen, errnop, &status)) {
+		status = nss_mtl_lookup_grnam(&caller, name, grp, buffer, buflen, errnop);
+	}
+
+	nss_mtl_stats_record(NSS_MTL_STATS_GETGRNAM, started, nss_mtl_stats_result(status, *errnop), 0);
+	NSS_MTL_PROBE3(getgrnam_return, name, status, *errnop);
+	return status;
+}
+
+enum nss_status _nss_mtl_getgrgid_r(gid_t gid, struct group* grp, char* buffer, size_t buflen, int* errnop) {
+	NSS_MTL_PROBE1(getgrgid_entry, gid);
+	const uint64_t started = nss_mtl_stats_begin();
+	const nss_mtl_caller_t caller = { program_invocation_short_name, nss_mtl_current_user, false };
+
+	enum nss_status status = NSS_STATUS_UNAVAIL;
+	if (! nss_mtl_client_grgid(&caller, gid, grp, buffer, buflen, errnop, &status)) {
+		status = nss_mtl_lookup_grgid(&caller, gid, grp, buffer, buflen, errnop);
+	}
+
+	nss_mtl_stats_record(NSS_MTL_STATS_GETGRGID, started, nss_mtl_stats_result(status, *errnop), 0);
+	NSS_MTL_PROBE3(getgrgid_return, gid, status, *errnop);
+	return status;
+}
+
+enum nss_status _nss_mtl_initgroups_dyn(const char* user, gid_t group, long int* start, long int* size, gid_t** groupsp, long int limit, int* errnop) {
+	NSS_MTL_PROBE2(initgroups_entry, user, group);
+	const uint64_t started = nss_mtl_stats_begin();
+	const nss_mtl_caller_t caller = { program_invocation_short_name, nss_mtl_current_user, false };
+
+	enum nss_status status = NSS_STATUS_UNAVAIL;
+	if (! nss_mtl_client_initgroups(&caller, user, group, start, size, groupsp, limit, errnop, &status)) {
+		status = nss_mtl_lookup_initgroups(&caller, user, group, start, size, groupsp, limit, errnop);
+	}
+
+	nss_mtl_stats_record(NSS_MTL_STATS_INITGROUPS, started, nss_mtl_stats_result(status, *errnop), 0);
+	NSS_MTL_PROBE4(initgroups_return, user, status, *errnop, *start);
+	return status;
+}
+
+enum nss_status _nss_mtl_getgrent_r(struct group* grp, char* buffer, size_t buflen, int* errnop) {
+	NSS_MTL_PROBE(getgrent_entry);
+	const uint64_t started = nss_mtl_stats_begin();
+
+	enum nss_status status = nss_mtl_grent_read(grp, buffer, buflen, errnop);
 
+	nss_mtl_stats_record(NSS_MTL_STATS_GETGRENT, started, nss_mtl_stats_result(status, *errnop), 0);
+	NSS_MTL_PROBE2(getgrent_return, status, *errnop);
 	return status;
 }
\ No newline at end of file
@@ -39,6 +39,8 @@ enum nss_status _nss_mtl_getgrent_r(struct group* grp, char* buffer, size_t bufl
 enum nss_status _nss_mtl_getgrnam_r(const char* name, struct group* grp, char* buffer, size_t buflen, int* errnop);
 enum nss_status _nss_mtl_getgrgid_r(gid_t gid, struct group* grp, char* buffer, size_t buflen, int* errnop);
 
+enum nss_status _nss_mtl_initgroups_dyn(const char* user, gid_t group, long int* start, long int* size, gid_t** groupsp, long int limit, int* errnop);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,358 @@
+/*
+ * passwd.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <syslog.h>
+
+#include "passwd.h"
+#include "probes.h"
+#include "stats.h"
+
+#define NSS_MTL_PASSWD_FIELDS 7
+/* lookups answered by scanning the file before it gets indexed */
+#define NSS_MTL_PASSWD_SCANS 4
+
+static nss_mtl_snapshot_t* nss_mtl_passwd_load(const char* path);
+static void nss_mtl_passwd_destroy(nss_mtl_snapshot_t* snapshot);
+static bool nss_mtl_passwd_entries_add(nss_mtl_passwd_t* index, const nss_mtl_utils_span_t* line, size_t* capacity);
+static bool nss_mtl_passwd_table_build(nss_mtl_passwd_t* index);
+static bool nss_mtl_passwd_index_build(nss_mtl_passwd_t* index);
+static bool nss_mtl_passwd_db_load(nss_mtl_passwd_t* index, const char* path);
+static const nss_mtl_passwd_entry_t* nss_mtl_passwd_entry_find(const nss_mtl_passwd_t* index, const char* name, size_t len, uint32_t hash, size_t* slot);
+static bool nss_mtl_passwd_scan(const nss_mtl_passwd_t* index, const char* name, size_t len, nss_mtl_utils_span_t* line);
+static bool nss_mtl_passwd_line_find(const nss_mtl_passwd_t* index, const char* name, nss_mtl_utils_span_t* line);
+
+static nss_mtl_snapshot_slot_t nss_mtl_passwd_slot = NSS_MTL_SNAPSHOT_SLOT_INIT;
+
+/* implementation */
+
+bool nss_mtl_passwd_entries_add(nss_mtl_passwd_t* index, const nss_mtl_utils_span_t* line, size_t* capacity) {
+	nss_mtl_utils_span_t fields[NSS_MTL_PASSWD_FIELDS];
+	if (nss_mtl_utils_span_split(line, ':', fields, NSS_MTL_PASSWD_FIELDS) != NSS_MTL_PASSWD_FIELDS) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: skipping malformed line in %s", __func__, NSS_MTL_PASSWD_FILE);
+		return true;
+	}
+	if (fields[0].length == 0) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: found empty username in passwd file", __func__);
+		return true;
+	}
+
+	if (index->count == *capacity) {
+		const size_t new_capacity = *capacity > 0 ? *capacity * 2 : 64;
+		nss_mtl_passwd_entry_t* entries = realloc(index->entries, new_capacity * sizeof(nss_mtl_passwd_entry_t));
+		if (entries == NULL) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for %lu entries", __func__, new_capacity);
+			return false;
+		}
+		index->entries = entries;
+		*capacity = new_capacity;
+	}
+
+	nss_mtl_passwd_entry_t* entry = &index->entries[index->count++];
+	entry->offset = line->start - index->data;
+	entry->length = line->length;
+	entry->name_length = fields[0].length;
+	entry->hash = nss_mtl_utils_hash(fields[0].start, fields[0].length);
+
+	return true;
+}
+
+bool nss_mtl_passwd_table_build(nss_mtl_passwd_t* index) {
+	/* keep load factor at or below 50% so that probe sequences stay short */
+	size_t size = 16;
+	while (size < index->count * 2) {
+		size *= 2;
+	}
+
+	index->table = calloc(size, sizeof(size_t));
+	if (index->table == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate hash table of size %lu", __func__, size);
+		return false;
+	}
+	index->mask = size - 1;
+
+	for (size_t i = 0; i < index->count; ++i) {
+		const nss_mtl_passwd_entry_t* entry = &index->entries[i];
+		size_t slot = 0;
+		/* first entry wins, just like a sequential scan would */
+		if (nss_mtl_passwd_entry_find(index, index->data + entry->offset, entry->name_length, entry->hash, &slot) == NULL) {
+			index->table[slot] = i + 1;
+		}
+	}
+
+	return true;
+}
+
+const nss_mtl_passwd_entry_t* nss_mtl_passwd_entry_find(const nss_mtl_passwd_t* index, const char* name, size_t len, uint32_t hash, size_t* slot) {
+	size_t pos = hash & index->mask;
+	while (index->table[pos] != 0) {
+		const nss_mtl_passwd_entry_t* entry = &index->entries[index->table[pos] - 1];
+		if (entry->hash == hash && entry->name_length == len && memcmp(index->data + entry->offset, name, len) == 0) {
+			return entry;
+		}
+		pos = (pos + 1) & index->mask;
+	}
+
+	if (slot != NULL) {
+		*slot = pos;
+	}
+
+	return NULL;
+}
+
+bool nss_mtl_passwd_index_build(nss_mtl_passwd_t* index) {
+	size_t capacity = 0;
+	const char* pos = index->data;
+	const char* end = index->data + index->size;
+	while (pos < end) {
+		const char* eol = memchr(pos, '\n', end - pos);
+		nss_mtl_utils_span_t line = { pos, (eol != NULL ? eol : end) - pos };
+		if (line.length > 0 && ! nss_mtl_passwd_entries_add(index, &line, &capacity)) {
+			break;
+		}
+		pos += line.length + 1;
+	}
+
+	if (pos < end || ! nss_mtl_passwd_table_build(index)) {
+		free(index->entries);
+		index->entries = NULL;
+		index->count = 0;
+		return false;
+	}
+
+	nss_mtl_utils_log(LOG_DEBUG, "%s: indexed %lu users from %s", __func__, index->count, NSS_MTL_PASSWD_FILE);
+
+	return true;
+}
+
+bool nss_mtl_passwd_scan(const nss_mtl_passwd_t* index, const char* name, size_t len, nss_mtl_utils_span_t* line) {
+	if (len == 0) {
+		return false;
+	}
+
+	NSS_MTL_PROBE1(passwd_scan_entry, name);
+
+	/* memmem skips whole lines at once, only candidates at line starts followed by ':' get split */
+	const char* pos = index->data;
+	const char* end = index->data + index->size;
+	bool matched = false;
+	while (! matched && (size_t)(end - pos) > len) {
+		const char* found = memmem(pos, end - pos, name, len);
+		if (found == NULL || (size_t)(end - found) <= len) {
+			break;
+		}
+		pos = found + 1;
+		if ((found != index->data && found[-1] != '\n') || found[len] != ':') {
+			continue;
+		}
+
+		const char* eol = memchr(found + len, '\n', end - found - len);
+		line->start = found;
+		line->length = (eol != NULL ? eol : end) - found;
+
+		/* malformed lines are skipped, just like when indexing */
+		nss_mtl_utils_span_t fields[NSS_MTL_PASSWD_FIELDS];
+		matched = nss_mtl_utils_span_split(line, ':', fields, NSS_MTL_PASSWD_FIELDS) == NSS_MTL_PASSWD_FIELDS;
+	}
+
+	NSS_MTL_PROBE3(passwd_scan_return, name, matched, matched ? (size_t)(line->start + line->length - index->data) : index->size);
+	return matched;
+}
+
+bool nss_mtl_passwd_line_find(const nss_mtl_passwd_t* index, const char* name, nss_mtl_utils_span_t* line) {
+	const size_t len = strlen(name);
+
+	/* index is shared, scans counter is the only part of it lookups modify */
+	atomic_uint* scans = (atomic_uint*)&index->scans;
+	if (! atomic_load_explicit(&index->indexed, memory_order_acquire)
+			&& (atomic_fetch_add_explicit(scans, 1, memory_order_relaxed) < NSS_MTL_PASSWD_SCANS || ! nss_mtl_passwd_index(index))) {
+		return nss_mtl_passwd_scan(index, name, len, line);
+	}
+
+	const nss_mtl_passwd_entry_t* entry = nss_mtl_passwd_entry_find(index, name, len, nss_mtl_utils_hash(name, len), NULL);
+	if (entry == NULL) {
+		return false;
+	}
+	line->start = index->data + entry->offset;
+	line->length = entry->length;
+
+	return true;
+}
+
+bool nss_mtl_passwd_db_load(nss_mtl_passwd_t* index, const char* path) {
+	nss_mtl_utils_stamp_t stamp;
+	if (! nss_mtl_utils_stamp_read(path, &stamp) || ! nss_mtl_db_open(NSS_MTL_DB_FILE, &index->db)) {
+		return false;
+	}
+	if (! nss_mtl_utils_stamp_equal(&index->db.header->passwd_stamp, &stamp)) {
+		nss_mtl_utils_log(LOG_DEBUG, "%s: %s changed since %s was built", __func__, path, NSS_MTL_DB_FILE);
+		nss_mtl_db_close(&index->db);
+		return false;
+	}
+
+	size_t entries_size = 0;
+	size_t table_size = 0;
+	index->data = nss_mtl_db_section(&index->db, NSS_MTL_DB_PASSWD_DATA, &index->size);
+	index->entries = (nss_mtl_passwd_entry_t*)nss_mtl_db_section(&index->db, NSS_MTL_DB_PASSWD_ENTRIES, &entries_size);
+	index->table = (size_t*)nss_mtl_db_section(&index->db, NSS_MTL_DB_PASSWD_TABLE, &table_size);
+	index->count = entries_size / sizeof(nss_mtl_passwd_entry_t);
+	index->mask = table_size / sizeof(size_t) - 1;
+
+	/* lines themselves were validated by mtl_makedb, only bounds are checked here */
+	bool valid = entries_size % sizeof(nss_mtl_passwd_entry_t) == 0 && nss_mtl_db_table_valid(index->table, table_size, index->count);
+	for (size_t i = 0; valid && i < index->count; ++i) {
+		const nss_mtl_passwd_entry_t* entry = &index->entries[i];
+		valid = entry->offset <= index->size && entry->length <= index->size - entry->offset && entry->name_length < entry->length;
+	}
+	if (! valid) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: passwd index in %s is damaged, ignoring it", __func__, NSS_MTL_DB_FILE);
+		nss_mtl_db_close(&index->db);
+		index->entries = NULL;
+		index->table = NULL;
+		index->count = 0;
+		return false;
+	}
+
+	return true;
+}
+
+nss_mtl_snapshot_t* nss_mtl_passwd_load(const char* path) {
+	const uint64_t started = nss_mtl_stats_begin();
+	NSS_MTL_PROBE1(passwd_load_entry, path);
+	nss_mtl_passwd_t* index = calloc(1, sizeof(nss_mtl_passwd_t));
+	if (index == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate passwd index: %m", __func__);
+		NSS_MTL_PROBE3(passwd_load_return, path, false, 0);
+		return NULL;
+	}
+	nss_mtl_snapshot_init(&index->snapshot, nss_mtl_passwd_destroy);
+
+	pthread_mutex_init(&index->lock, NULL);
+
+	if (nss_mtl_passwd_db_load(index, path)) {
+		nss_mtl_utils_log(LOG_DEBUG, "%s: using %lu users of %s from %s", __func__, index->count, path, NSS_MTL_DB_FILE);
+		atomic_store(&index->indexed, true);
+		nss_mtl_stats_record(NSS_MTL_STATS_PASSWD_LOAD, started, NSS_MTL_STATS_SUCCESS, 0);
+		NSS_MTL_PROBE3(passwd_load_return, path, true, 0);
+		return &index->snapshot;
+	}
+
+	if (! nss_mtl_utils_file_map(path, &index->data, &index->size)) {
+		pthread_mutex_destroy(&index->lock);
+		free(index);
+		NSS_MTL_PROBE3(passwd_load_return, path, false, 0);
+		return NULL;
+	}
+
+	nss_mtl_utils_log(LOG_DEBUG, "%s: mapped %lu bytes of %s", __func__, index->size, path);
+	nss_mtl_stats_record(NSS_MTL_STATS_PASSWD_LOAD, started, NSS_MTL_STATS_SUCCESS, index->size);
+	NSS_MTL_PROBE3(passwd_load_return, path, true, index->size);
+
+	return &index->snapshot;
+}
+
+void nss_mtl_passwd_destroy(nss_mtl_snapshot_t* snapshot) {
+	nss_mtl_passwd_t* index = (nss_mtl_passwd_t*)snapshot;
+
+	if (index->db.data != NULL) {
+		nss_mtl_db_close(&index->db);
+	} else {
+		nss_mtl_utils_file_unmap(index->data, index->size);
+		free(index->entries);
+		free(index->table);
+	}
+	pthread_mutex_destroy(&index->lock);
+	free(index);
+}
+
+const nss_mtl_passwd_t* nss_mtl_passwd_acquire(void) {
+	return (const nss_mtl_passwd_t*)nss_mtl_snapshot_acquire_file(&nss_mtl_passwd_slot, NSS_MTL_PASSWD_FILE, nss_mtl_passwd_load);
+}
+
+void nss_mtl_passwd_release(const nss_mtl_passwd_t* index) {
+	if (index != NULL) {
+		nss_mtl_snapshot_release((nss_mtl_snapshot_t*)&index->snapshot);
+	}
+}
+
+bool nss_mtl_passwd_index(const nss_mtl_passwd_t* index) {
+	assert(index != NULL);
+
+	if (atomic_load_explicit(&index->indexed, memory_order_acquire)) {
+		return true;
+	}
+
+	/* built at most once, readers see it complete through the release store */
+	nss_mtl_passwd_t* shared = (nss_mtl_passwd_t*)index;
+	pthread_mutex_lock(&shared->lock);
+	bool indexed = atomic_load_explicit(&shared->indexed, memory_order_relaxed);
+	if (! indexed) {
+		NSS_MTL_PROBE1(passwd_index_entry, shared->size);
+		indexed = nss_mtl_passwd_index_build(shared);
+		if (indexed) {
+			atomic_store_explicit(&shared->indexed, true, memory_order_release);
+		}
+		NSS_MTL_PROBE2(passwd_index_return, indexed, shared->count);
+	}
+	pthread_mutex_unlock(&shared->lock);
+
+	return indexed;
+}
+
+bool nss_mtl_passwd_contains(const nss_mtl_passwd_t* index, const char* name) {
+	assert(index != NULL);
+	assert(name != NULL);
+
+	nss_mtl_utils_span_t line;
+	return nss_mtl_passwd_line_find(index, name, &line);
+}
+
+bool nss_mtl_passwd_find(const nss_mtl_passwd_t* index, const char* name, nss_mtl_passwd_record_t* record) {
+	assert(index != NULL);
+	assert(name != NULL);
+	assert(record != NULL);
+
+	nss_mtl_utils_span_t line;
+	if (! nss_mtl_passwd_line_find(index, name, &line)) {
+		return false;
+	}
+
+	/* line was validated while indexing or scanning */
+	nss_mtl_utils_span_t fields[NSS_MTL_PASSWD_FIELDS];
+	nss_mtl_utils_span_split(&line, ':', fields, NSS_MTL_PASSWD_FIELDS);
+
+	unsigned long uid = 0;
+	unsigned long gid = 0;
+	if (! nss_mtl_utils_span_id(&fields[2], &uid) || ! nss_mtl_utils_span_id(&fields[3], &gid)) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: invalid uid or gid of user %s", __func__, name);
+		return false;
+	}
+
+	record->name = fields[0];
+	record->passwd = fields[1];
+	record->uid = uid;
+	record->gid = gid;
+	record->gecos = fields[4];
+	record->dir = fields[5];
+	record->shell = fields[6];
+
+	return true;
+}
\ No newline at end of file
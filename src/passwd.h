@@ -0,0 +1,85 @@
+/*
+ * passwd.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_PASSWD_H
+#define NSS_MTL_PASSWD_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "db.h"
+#include "snapshot.h"
+#include "utils.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	size_t offset;
+	size_t length;
+	size_t name_length;
+	uint32_t hash;
+} nss_mtl_passwd_entry_t;
+
+/*
+ * mmap'ed copy of passwd file with hash index over user names, all of them
+ * pointing into the database instead when it is up to date; first lookups
+ * scan the data and the index is built only once they keep coming
+ */
+typedef struct nss_mtl_passwd {
+	nss_mtl_snapshot_t snapshot;
+	nss_mtl_db_t db;
+	const char* data;
+	size_t size;
+	atomic_bool indexed;
+	atomic_uint scans;
+	pthread_mutex_t lock;
+	size_t count;
+	nss_mtl_passwd_entry_t* entries;
+	size_t mask;
+	size_t* table;
+} nss_mtl_passwd_t;
+
+/* fields of a single passwd line, pointing into the index data */
+typedef struct {
+	nss_mtl_utils_span_t name;
+	nss_mtl_utils_span_t passwd;
+	uid_t uid;
+	gid_t gid;
+	nss_mtl_utils_span_t gecos;
+	nss_mtl_utils_span_t dir;
+	nss_mtl_utils_span_t shell;
+} nss_mtl_passwd_record_t;
+
+const nss_mtl_passwd_t* nss_mtl_passwd_acquire(void);
+void nss_mtl_passwd_release(const nss_mtl_passwd_t* index);
+
+bool nss_mtl_passwd_index(const nss_mtl_passwd_t* index);
+bool nss_mtl_passwd_contains(const nss_mtl_passwd_t* index, const char* name);
+bool nss_mtl_passwd_find(const nss_mtl_passwd_t* index, const char* name, nss_mtl_passwd_record_t* record);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_PASSWD_H */
\ No newline at end of file
@@ -0,0 +1,357 @@
+/*
+ * pattern.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+
+#include "pattern.h"
+#include "utils.h"
+
+typedef enum {
+	NSS_MTL_PATTERN_LITERAL = 0,
+	NSS_MTL_PATTERN_ANY,
+	NSS_MTL_PATTERN_STAR,
+	NSS_MTL_PATTERN_END,
+} nss_mtl_pattern_kind_t;
+
+/* position within one of the patterns, i.e. NFA state */
+typedef struct {
+	nss_mtl_pattern_kind_t kind;
+	unsigned char c;
+	/* value of the pattern, used at its end */
+	uint32_t value;
+} nss_mtl_pattern_position_t;
+
+/*
+ * Subset construction state. Every DFA state is a sorted set of positions,
+ * all of them kept in a single pool and deduplicated through a hash table.
+ */
+typedef struct {
+	nss_mtl_pattern_position_t* positions;
+	size_t count;
+	bool* marks;
+	uint32_t* marked;
+	size_t marked_count;
+	uint32_t* pool;
+	size_t pool_size;
+	size_t pool_capacity;
+	size_t* set_offsets;
+	size_t* set_lengths;
+	size_t capacity;
+	uint32_t* table;
+	size_t mask;
+	/* construction stopped at NSS_MTL_PATTERN_MAX_STATES rather than for lack of memory */
+	bool too_complex;
+} nss_mtl_pattern_builder_t;
+
+static bool nss_mtl_pattern_positions_build(nss_mtl_pattern_builder_t* builder, const nss_mtl_utils_set_t* globs);
+static void nss_mtl_pattern_classes_build(nss_mtl_pattern_t* pattern, const nss_mtl_pattern_builder_t* builder);
+static void nss_mtl_pattern_mark(nss_mtl_pattern_builder_t* builder, size_t position);
+static int nss_mtl_pattern_position_cmp(const void* a, const void* b);
+static bool nss_mtl_pattern_state_add(nss_mtl_pattern_t* pattern, nss_mtl_pattern_builder_t* builder, uint32_t* state);
+static bool nss_mtl_pattern_state_grow(nss_mtl_pattern_t* pattern, nss_mtl_pattern_builder_t* builder);
+static void nss_mtl_pattern_builder_free(nss_mtl_pattern_builder_t* builder);
+static nss_mtl_pattern_t* nss_mtl_pattern_copy(const nss_mtl_pattern_t* pattern, nss_mtl_arena_t* arena);
+static void nss_mtl_pattern_free(nss_mtl_pattern_t* pattern);
+
+/* implementation */
+
+bool nss_mtl_pattern_is_glob(const char* str, size_t len) {
+	return memchr(str, '*', len) != NULL || memchr(str, '?', len) != NULL;
+}
+
+bool nss_mtl_pattern_positions_build(nss_mtl_pattern_builder_t* builder, const nss_mtl_utils_set_t* globs) {
+	size_t count = 0;
+	for (size_t i = 0; i <= globs->mask; ++i) {
+		if (globs->slots[i].item != NULL) {
+			count += strlen(globs->slots[i].item) + 1;
+		}
+	}
+
+	builder->positions = malloc(count * sizeof(nss_mtl_pattern_position_t));
+	builder->marks = calloc(count, sizeof(bool));
+	builder->marked = malloc(count * sizeof(uint32_t));
+	if (builder->positions == NULL || builder->marks == NULL || builder->marked == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate %lu pattern positions", __func__, count);
+		return false;
+	}
+
+	for (size_t i = 0; i <= globs->mask; ++i) {
+		const char* glob = globs->slots[i].item;
+		if (glob == NULL) {
+			continue;
+		}
+		for (const char* c = glob; *c != '\0'; ++c) {
+			nss_mtl_pattern_position_t* position = &builder->positions[builder->count++];
+			position->kind = *c == '*' ? NSS_MTL_PATTERN_STAR : (*c == '?' ? NSS_MTL_PATTERN_ANY : NSS_MTL_PATTERN_LITERAL);
+			position->c = *c;
+			position->value = globs->slots[i].value;
+		}
+		builder->positions[builder->count].kind = NSS_MTL_PATTERN_END;
+		builder->positions[builder->count].c = '\0';
+		builder->positions[builder->count].value = globs->slots[i].value;
+		++builder->count;
+	}
+
+	return true;
+}
+
+void nss_mtl_pattern_classes_build(nss_mtl_pattern_t* pattern, const nss_mtl_pattern_builder_t* builder) {
+	/* every literal byte gets its own class, all the others share class 0 */
+	memset(pattern->byte_class, 0, sizeof(pattern->byte_class));
+	pattern->classes = 1;
+	for (size_t i = 0; i < builder->count; ++i) {
+		const nss_mtl_pattern_position_t* position = &builder->positions[i];
+		if (position->kind == NSS_MTL_PATTERN_LITERAL && pattern->byte_class[position->c] == 0 && pattern->classes < 256) {
+			pattern->byte_class[position->c] = pattern->classes++;
+		}
+	}
+}
+
+void nss_mtl_pattern_mark(nss_mtl_pattern_builder_t* builder, size_t position) {
+	/* star may match empty sequence, so position after it is reachable as well */
+	while (! builder->marks[position]) {
+		builder->marks[position] = true;
+		builder->marked[builder->marked_count++] = position;
+		if (builder->positions[position].kind != NSS_MTL_PATTERN_STAR) {
+			break;
+		}
+		++position;
+	}
+}
+
+int nss_mtl_pattern_position_cmp(const void* a, const void* b) {
+	const uint32_t pa = *(const uint32_t*)a;
+	const uint32_t pb = *(const uint32_t*)b;
+
+	return (pa > pb) - (pa < pb);
+}
+
+bool nss_mtl_pattern_state_grow(nss_mtl_pattern_t* pattern, nss_mtl_pattern_builder_t* builder) {
+	const size_t capacity = builder->capacity > 0 ? 2 * builder->capacity : 64;
+	size_t* set_offsets = realloc(builder->set_offsets, capacity * sizeof(size_t));
+	if (set_offsets != NULL) {
+		builder->set_offsets = set_offsets;
+	}
+	size_t* set_lengths = realloc(builder->set_lengths, capacity * sizeof(size_t));
+	if (set_lengths != NULL) {
+		builder->set_lengths = set_lengths;
+	}
+	uint32_t* transitions = realloc(pattern->transitions, capacity * pattern->classes * sizeof(uint32_t));
+	if (transitions != NULL) {
+		pattern->transitions = transitions;
+	}
+	uint32_t* accepting = realloc(pattern->accepting, capacity * sizeof(uint32_t));
+	if (accepting != NULL) {
+		pattern->accepting = accepting;
+	}
+	/* table is twice the capacity, so that probe sequences stay short */
+	uint32_t* table = calloc(2 * capacity, sizeof(uint32_t));
+	if (set_offsets == NULL || set_lengths == NULL || transitions == NULL || accepting == NULL || table == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate DFA of %lu states", __func__, capacity);
+		free(table);
+		return false;
+	}
+
+	free(builder->table);
+	builder->table = table;
+	builder->mask = 2 * capacity - 1;
+	builder->capacity = capacity;
+	for (uint32_t state = 0; state < pattern->states; ++state) {
+		const uint32_t* set = builder->pool + builder->set_offsets[state];
+		size_t slot = nss_mtl_utils_hash((const char*)set, builder->set_lengths[state] * sizeof(uint32_t)) & builder->mask;
+		while (builder->table[slot] != 0) {
+			slot = (slot + 1) & builder->mask;
+		}
+		builder->table[slot] = state + 1;
+	}
+
+	return true;
+}
+
+bool nss_mtl_pattern_state_add(nss_mtl_pattern_t* pattern, nss_mtl_pattern_builder_t* builder, uint32_t* state) {
+	/* marked positions, once sorted, are the set describing the state */
+	if (builder->pool_capacity - builder->pool_size < builder->marked_count) {
+		const size_t pool_capacity = 2 * builder->pool_capacity + builder->marked_count;
+		uint32_t* pool = realloc(builder->pool, pool_capacity * sizeof(uint32_t));
+		if (pool == NULL) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate DFA state pool of size %lu", __func__, pool_capacity);
+			return false;
+		}
+		builder->pool = pool;
+		builder->pool_capacity = pool_capacity;
+	}
+
+	uint32_t* set = builder->pool + builder->pool_size;
+	const size_t length = builder->marked_count;
+	uint32_t accepting = 0;
+	qsort(builder->marked, length, sizeof(uint32_t), nss_mtl_pattern_position_cmp);
+	for (size_t i = 0; i < length; ++i) {
+		set[i] = builder->marked[i];
+		builder->marks[set[i]] = false;
+		const nss_mtl_pattern_position_t* position = &builder->positions[set[i]];
+		if (position->kind == NSS_MTL_PATTERN_END && (accepting == 0 || position->value < accepting - 1)) {
+			accepting = position->value + 1;
+		}
+	}
+	builder->marked_count = 0;
+
+	size_t slot = nss_mtl_utils_hash((const char*)set, length * sizeof(uint32_t)) & builder->mask;
+	while (builder->table[slot] != 0) {
+		const uint32_t existing = builder->table[slot] - 1;
+		if (builder->set_lengths[existing] == length && memcmp(builder->pool + builder->set_offsets[existing], set, length * sizeof(uint32_t)) == 0) {
+			*state = existing;
+			return true;
+		}
+		slot = (slot + 1) & builder->mask;
+	}
+
+	if (pattern->states == NSS_MTL_PATTERN_MAX_STATES) {
+		nss_mtl_utils_log(LOG_ERR, "%s: patterns need more than %d DFA states", __func__, NSS_MTL_PATTERN_MAX_STATES);
+		builder->too_complex = true;
+		return false;
+	}
+
+	*state = pattern->states++;
+	builder->set_offsets[*state] = builder->pool_size;
+	builder->set_lengths[*state] = length;
+	builder->pool_size += length;
+	builder->table[slot] = *state + 1;
+	pattern->accepting[*state] = accepting;
+	memset(pattern->transitions + *state * pattern->classes, 0, pattern->classes * sizeof(uint32_t));
+
+	/* table must stay at most half full */
+	if (pattern->states == builder->capacity) {
+		return nss_mtl_pattern_state_grow(pattern, builder);
+	}
+
+	return true;
+}
+
+void nss_mtl_pattern_builder_free(nss_mtl_pattern_builder_t* builder) {
+	free(builder->positions);
+	free(builder->marks);
+	free(builder->marked);
+	free(builder->pool);
+	free(builder->set_offsets);
+	free(builder->set_lengths);
+	free(builder->table);
+}
+
+nss_mtl_pattern_t* nss_mtl_pattern_copy(const nss_mtl_pattern_t* pattern, nss_mtl_arena_t* arena) {
+	const size_t transitions_size = pattern->states * pattern->classes * sizeof(uint32_t);
+	const size_t accepting_size = pattern->states * sizeof(uint32_t);
+	nss_mtl_pattern_t* copy = nss_mtl_arena_alloc(arena, sizeof(nss_mtl_pattern_t) + transitions_size + accepting_size);
+	if (copy == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate pattern of %lu states", __func__, pattern->states);
+		return NULL;
+	}
+
+	*copy = *pattern;
+	copy->transitions = (uint32_t*)(copy + 1);
+	copy->accepting = copy->transitions + pattern->states * pattern->classes;
+	memcpy(copy->transitions, pattern->transitions, transitions_size);
+	memcpy(copy->accepting, pattern->accepting, accepting_size);
+
+	return copy;
+}
+
+nss_mtl_pattern_t* nss_mtl_pattern_compile(const nss_mtl_utils_set_t* globs, nss_mtl_arena_t* arena) {
+	nss_mtl_pattern_t* pattern = calloc(1, sizeof(nss_mtl_pattern_t));
+	if (pattern == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate pattern: %m", __func__);
+		return NULL;
+	}
+
+	nss_mtl_pattern_builder_t builder;
+	memset(&builder, 0, sizeof(builder));
+	bool ok = nss_mtl_pattern_positions_build(&builder, globs);
+	if (ok) {
+		nss_mtl_pattern_classes_build(pattern, &builder);
+		ok = nss_mtl_pattern_state_grow(pattern, &builder);
+	}
+
+	/* dead state first, then the initial one made of pattern starts */
+	uint32_t state = 0;
+	ok = ok && nss_mtl_pattern_state_add(pattern, &builder, &state);
+	for (size_t i = 0; ok && i < builder.count; ++i) {
+		if (i == 0 || builder.positions[i - 1].kind == NSS_MTL_PATTERN_END) {
+			nss_mtl_pattern_mark(&builder, i);
+		}
+	}
+	ok = ok && nss_mtl_pattern_state_add(pattern, &builder, &state);
+
+	/* states are numbered in order of discovery, so walking them in order visits all */
+	for (uint32_t current = 1; ok && current < pattern->states; ++current) {
+		for (size_t cls = 0; ok && cls < pattern->classes; ++cls) {
+			const uint32_t* set = builder.pool + builder.set_offsets[current];
+			for (size_t i = 0; i < builder.set_lengths[current]; ++i) {
+				const nss_mtl_pattern_position_t* position = &builder.positions[set[i]];
+				if (position->kind == NSS_MTL_PATTERN_STAR) {
+					nss_mtl_pattern_mark(&builder, set[i]);
+				} else if (position->kind == NSS_MTL_PATTERN_ANY || (position->kind == NSS_MTL_PATTERN_LITERAL && pattern->byte_class[position->c] == cls)) {
+					nss_mtl_pattern_mark(&builder, set[i] + 1);
+				}
+			}
+			ok = nss_mtl_pattern_state_add(pattern, &builder, &state);
+			if (ok) {
+				pattern->transitions[current * pattern->classes + cls] = state;
+			}
+		}
+	}
+
+	if (ok) {
+		nss_mtl_utils_log(LOG_DEBUG, "%s: compiled %lu patterns into %lu states and %lu classes", __func__, globs->count, pattern->states, pattern->classes);
+	}
+	nss_mtl_pattern_builder_free(&builder);
+
+	/* tables were grown during construction, final ones go to the arena in one piece */
+	nss_mtl_pattern_t* compiled = ok ? nss_mtl_pattern_copy(pattern, arena) : NULL;
+	nss_mtl_pattern_free(pattern);
+	if (compiled == NULL) {
+		errno = builder.too_complex ? E2BIG : ENOMEM;
+	}
+
+	return compiled;
+}
+
+void nss_mtl_pattern_free(nss_mtl_pattern_t* pattern) {
+	if (pattern != NULL) {
+		free(pattern->transitions);
+		free(pattern->accepting);
+		free(pattern);
+	}
+}
+
+bool nss_mtl_pattern_match(const nss_mtl_pattern_t* pattern, const char* str, uint32_t* value) {
+	uint32_t state = 1;
+	for (const unsigned char* c = (const unsigned char*)str; *c != '\0' && state != 0; ++c) {
+		state = pattern->transitions[state * pattern->classes + pattern->byte_class[*c]];
+	}
+
+	if (pattern->accepting[state] == 0) {
+		return false;
+	}
+	if (value != NULL) {
+		*value = pattern->accepting[state] - 1;
+	}
+	return true;
+}
\ No newline at end of file
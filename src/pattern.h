@@ -0,0 +1,64 @@
+/*
+ * pattern.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_PATTERN_H
+#define NSS_MTL_PATTERN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "utils.h"
+
+/* upper bound for DFA size, patterns needing more are rejected */
+#define NSS_MTL_PATTERN_MAX_STATES 65536
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Set of glob patterns, where '*' matches any sequence of characters and
+ * '?' any single one, compiled into a single DFA. Matching is one pass over
+ * the name, whatever the number of patterns. State 0 rejects everything,
+ * matching starts in state 1. Every pattern carries value of its set slot,
+ * accepting state keeps the lowest one plus 1, so that 0 means no match.
+ */
+typedef struct {
+	size_t states;
+	size_t classes;
+	uint8_t byte_class[256];
+	uint32_t* transitions;
+	uint32_t* accepting;
+} nss_mtl_pattern_t;
+
+bool nss_mtl_pattern_is_glob(const char* str, size_t len);
+/*
+ * Result lives in the arena, only the construction itself uses heap. NULL
+ * sets errno to E2BIG when the patterns need too many DFA states, to ENOMEM
+ * otherwise.
+ */
+nss_mtl_pattern_t* nss_mtl_pattern_compile(const nss_mtl_utils_set_t* globs, nss_mtl_arena_t* arena);
+bool nss_mtl_pattern_match(const nss_mtl_pattern_t* pattern, const char* str, uint32_t* value);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_PATTERN_H */
\ No newline at end of file
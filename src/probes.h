@@ -0,0 +1,56 @@
+/*
+ * probes.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_PROBES_H
+#define NSS_MTL_PROBES_H
+
+/*
+ * USDT probes of provider nss_mtl, listed by `bpftrace -l 'usdt:/usr/lib/libnss_mtl.so.2:*'`.
+ * Entry points fire <name>_entry and <name>_return, loads and scans of files fire
+ * <phase>_entry and <phase>_return with result and byte count. Every probe is a single nop
+ * until a tracer attaches. They are left out when built with USDT=0 or without <sys/sdt.h>.
+ */
+
+#ifndef NSS_MTL_USDT
+#define NSS_MTL_USDT 1
+#endif
+
+#if NSS_MTL_USDT && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define NSS_MTL_PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef NSS_MTL_PROBES_ENABLED
+#define NSS_MTL_PROBE(name) DTRACE_PROBE(nss_mtl, name)
+#define NSS_MTL_PROBE1(name, a1) DTRACE_PROBE1(nss_mtl, name, a1)
+#define NSS_MTL_PROBE2(name, a1, a2) DTRACE_PROBE2(nss_mtl, name, a1, a2)
+#define NSS_MTL_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(nss_mtl, name, a1, a2, a3)
+#define NSS_MTL_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(nss_mtl, name, a1, a2, a3, a4)
+#else
+/* arguments are not evaluated, sizeof only keeps variables used by probes alone from being reported as unused */
+#define NSS_MTL_PROBE(name) do { } while (0)
+#define NSS_MTL_PROBE1(name, a1) do { (void)sizeof(a1); } while (0)
+#define NSS_MTL_PROBE2(name, a1, a2) do { (void)sizeof(a1); (void)sizeof(a2); } while (0)
+#define NSS_MTL_PROBE3(name, a1, a2, a3) do { (void)sizeof(a1); (void)sizeof(a2); (void)sizeof(a3); } while (0)
+#define NSS_MTL_PROBE4(name, a1, a2, a3, a4) do { (void)sizeof(a1); (void)sizeof(a2); (void)sizeof(a3); (void)sizeof(a4); } while (0)
+#endif
+
+#endif /* NSS_MTL_PROBES_H */
\ No newline at end of file
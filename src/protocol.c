@@ -0,0 +1,335 @@
+/*
+ * protocol.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <time.h>
+#include <poll.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "lookup.h"
+#include "protocol.h"
+#include "utils.h"
+
+static uint64_t nss_mtl_protocol_now(void);
+static bool nss_mtl_protocol_wait(int fd, short events, uint64_t deadline);
+static bool nss_mtl_protocol_offset(const char* str, const char* buffer, size_t buflen, uint32_t* offset, size_t* extent);
+static bool nss_mtl_protocol_pointer(const char* image, size_t size, uint32_t offset, char* base, char** str);
+
+/* implementation */
+
+uint64_t nss_mtl_protocol_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t nss_mtl_protocol_deadline(unsigned int timeout_ms) {
+	return nss_mtl_protocol_now() + timeout_ms;
+}
+
+bool nss_mtl_protocol_wait(int fd, short events, uint64_t deadline) {
+	struct pollfd pfd = { .fd = fd, .events = events };
+	for (;;) {
+		const uint64_t now = nss_mtl_protocol_now();
+		if (now >= deadline) {
+			errno = ETIMEDOUT;
+			return false;
+		}
+		const int ready = poll(&pfd, 1, deadline - now);
+		if (ready == -1 && errno == EINTR) {
+			continue;
+		}
+		if (ready == 0) {
+			errno = ETIMEDOUT;
+		}
+		return ready > 0;
+	}
+}
+
+bool nss_mtl_protocol_send(int fd, const void* data, size_t len, uint64_t deadline) {
+	const char* pos = data;
+	while (len > 0) {
+		if (! nss_mtl_protocol_wait(fd, POLLOUT, deadline)) {
+			return false;
+		}
+		ssize_t sent = send(fd, pos, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent == -1) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			return false;
+		}
+		pos += sent;
+		len -= sent;
+	}
+
+	return true;
+}
+
+bool nss_mtl_protocol_recv(int fd, void* data, size_t len, uint64_t deadline) {
+	char* pos = data;
+	while (len > 0) {
+		if (! nss_mtl_protocol_wait(fd, POLLIN, deadline)) {
+			return false;
+		}
+		ssize_t got = recv(fd, pos, len, MSG_DONTWAIT);
+		if (got == -1 && (errno == EINTR || errno == EAGAIN)) {
+			continue;
+		}
+		if (got <= 0) {
+			return false;
+		}
+		pos += got;
+		len -= got;
+	}
+
+	return true;
+}
+
+bool nss_mtl_protocol_offset(const char* str, const char* buffer, size_t buflen, uint32_t* offset, size_t* extent) {
+	if (str == NULL || str < buffer || str >= buffer + buflen) {
+		return false;
+	}
+
+	const size_t off = str - buffer;
+	const size_t end = off + strnlen(str, buflen - off) + 1;
+	if (end > buflen) {
+		return false;
+	}
+
+	*offset = off;
+	if (end > *extent) {
+		*extent = end;
+	}
+
+	return true;
+}
+
+bool nss_mtl_protocol_pointer(const char* image, size_t size, uint32_t offset, char* base, char** str) {
+	if (offset >= size || memchr(image + offset, '\0', size - offset) == NULL) {
+		return false;
+	}
+
+	*str = base + offset;
+	return true;
+}
+
+size_t nss_mtl_protocol_passwd_pack(const struct passwd* pw, const char* buffer, size_t buflen, char** payload) {
+	nss_mtl_reply_passwd_t reply = { .uid = pw->pw_uid, .gid = pw->pw_gid };
+	size_t size = 0;
+	if (! nss_mtl_protocol_offset(pw->pw_name, buffer, buflen, &reply.name, &size)
+		|| ! nss_mtl_protocol_offset(pw->pw_passwd, buffer, buflen, &reply.passwd, &size)
+		|| ! nss_mtl_protocol_offset(pw->pw_gecos, buffer, buflen, &reply.gecos, &size)
+		|| ! nss_mtl_protocol_offset(pw->pw_dir, buffer, buflen, &reply.dir, &size)
+		|| ! nss_mtl_protocol_offset(pw->pw_shell, buffer, buflen, &reply.shell, &size)) {
+		nss_mtl_utils_log(LOG_ERR, "%s: passwd entry points outside of buffer", __func__);
+		return 0;
+	}
+	reply.size = size;
+
+	*payload = malloc(sizeof(reply) + size);
+	if (*payload == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer of size %lu", __func__, sizeof(reply) + size);
+		return 0;
+	}
+	memcpy(*payload, &reply, sizeof(reply));
+	memcpy(*payload + sizeof(reply), buffer, size);
+
+	return sizeof(reply) + size;
+}
+
+bool nss_mtl_protocol_passwd_unpack(const char* payload, size_t len, struct passwd* pw, char* buffer, size_t buflen) {
+	nss_mtl_reply_passwd_t reply;
+	if (len < sizeof(reply)) {
+		return false;
+	}
+	memcpy(&reply, payload, sizeof(reply));
+
+	const char* image = payload + sizeof(reply);
+	if (reply.size != len - sizeof(reply) || reply.size > buflen) {
+		return false;
+	}
+	if (! nss_mtl_protocol_pointer(image, reply.size, reply.name, buffer, &pw->pw_name)
+		|| ! nss_mtl_protocol_pointer(image, reply.size, reply.passwd, buffer, &pw->pw_passwd)
+		|| ! nss_mtl_protocol_pointer(image, reply.size, reply.gecos, buffer, &pw->pw_gecos)
+		|| ! nss_mtl_protocol_pointer(image, reply.size, reply.dir, buffer, &pw->pw_dir)
+		|| ! nss_mtl_protocol_pointer(image, reply.size, reply.shell, buffer, &pw->pw_shell)) {
+		return false;
+	}
+
+	memcpy(buffer, image, reply.size);
+	pw->pw_uid = reply.uid;
+	pw->pw_gid = reply.gid;
+
+	return true;
+}
+
+size_t nss_mtl_protocol_spwd_pack(const struct spwd* spw, const char* buffer, size_t buflen, char** payload) {
+	nss_mtl_reply_spwd_t reply = {
+		.lstchg = spw->sp_lstchg,
+		.min = spw->sp_min,
+		.max = spw->sp_max,
+		.warn = spw->sp_warn,
+		.inact = spw->sp_inact,
+		.expire = spw->sp_expire,
+		.flag = spw->sp_flag,
+	};
+	size_t size = 0;
+	if (! nss_mtl_protocol_offset(spw->sp_namp, buffer, buflen, &reply.namp, &size)
+		|| ! nss_mtl_protocol_offset(spw->sp_pwdp, buffer, buflen, &reply.pwdp, &size)) {
+		nss_mtl_utils_log(LOG_ERR, "%s: shadow entry points outside of buffer", __func__);
+		return 0;
+	}
+	reply.size = size;
+
+	*payload = malloc(sizeof(reply) + size);
+	if (*payload == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer of size %lu", __func__, sizeof(reply) + size);
+		return 0;
+	}
+	memcpy(*payload, &reply, sizeof(reply));
+	memcpy(*payload + sizeof(reply), buffer, size);
+
+	return sizeof(reply) + size;
+}
+
+bool nss_mtl_protocol_spwd_unpack(const char* payload, size_t len, struct spwd* spw, char* buffer, size_t buflen) {
+	nss_mtl_reply_spwd_t reply;
+	if (len < sizeof(reply)) {
+		return false;
+	}
+	memcpy(&reply, payload, sizeof(reply));
+
+	const char* image = payload + sizeof(reply);
+	if (reply.size != len - sizeof(reply) || reply.size > buflen) {
+		return false;
+	}
+	if (! nss_mtl_protocol_pointer(image, reply.size, reply.namp, buffer, &spw->sp_namp)
+		|| ! nss_mtl_protocol_pointer(image, reply.size, reply.pwdp, buffer, &spw->sp_pwdp)) {
+		return false;
+	}
+
+	memcpy(buffer, image, reply.size);
+	spw->sp_lstchg = reply.lstchg;
+	spw->sp_min = reply.min;
+	spw->sp_max = reply.max;
+	spw->sp_warn = reply.warn;
+	spw->sp_inact = reply.inact;
+	spw->sp_expire = reply.expire;
+	spw->sp_flag = reply.flag;
+
+	return true;
+}
+
+size_t nss_mtl_protocol_group_pack(const struct group* grp, const char* buffer, size_t buflen, char** payload) {
+	nss_mtl_reply_group_t reply = { .gid = grp->gr_gid };
+	size_t size = 0;
+	if (! nss_mtl_protocol_offset(grp->gr_name, buffer, buflen, &reply.name, &size)
+		|| ! nss_mtl_protocol_offset(grp->gr_passwd, buffer, buflen, &reply.passwd, &size)) {
+		nss_mtl_utils_log(LOG_ERR, "%s: group entry points outside of buffer", __func__);
+		return 0;
+	}
+
+	const char* mem = (const char*)grp->gr_mem;
+	if (mem < buffer || mem >= buffer + buflen) {
+		nss_mtl_utils_log(LOG_ERR, "%s: group members point outside of buffer", __func__);
+		return 0;
+	}
+	while (grp->gr_mem[reply.count] != NULL) {
+		++reply.count;
+	}
+	reply.mem = mem - buffer;
+	if (reply.mem + (reply.count + 1) * sizeof(char*) > size) {
+		size = reply.mem + (reply.count + 1) * sizeof(char*);
+	}
+
+	const size_t offsets_size = reply.count * sizeof(uint32_t);
+	uint32_t* offsets = malloc((reply.count + 1) * sizeof(uint32_t));
+	if (offsets == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer of size %lu", __func__, offsets_size);
+		return 0;
+	}
+	for (uint32_t i = 0; i < reply.count; ++i) {
+		if (! nss_mtl_protocol_offset(grp->gr_mem[i], buffer, buflen, &offsets[i], &size)) {
+			nss_mtl_utils_log(LOG_ERR, "%s: group member points outside of buffer", __func__);
+			free(offsets);
+			return 0;
+		}
+	}
+	reply.size = size;
+
+	*payload = malloc(sizeof(reply) + offsets_size + size);
+	if (*payload == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer of size %lu", __func__, sizeof(reply) + offsets_size + size);
+		free(offsets);
+		return 0;
+	}
+	memcpy(*payload, &reply, sizeof(reply));
+	memcpy(*payload + sizeof(reply), offsets, offsets_size);
+	memcpy(*payload + sizeof(reply) + offsets_size, buffer, size);
+	free(offsets);
+
+	return sizeof(reply) + offsets_size + size;
+}
+
+bool nss_mtl_protocol_group_unpack(const char* payload, size_t len, struct group* grp, char* buffer, size_t buflen) {
+	nss_mtl_reply_group_t reply;
+	if (len < sizeof(reply)) {
+		return false;
+	}
+	memcpy(&reply, payload, sizeof(reply));
+
+	/* member array is aligned within the image, so the image goes to an aligned place in caller's buffer */
+	const size_t padding = nss_mtl_group_adapt_padding(buffer);
+	const size_t offsets_size = (size_t)reply.count * sizeof(uint32_t);
+	const char* offsets = payload + sizeof(reply);
+	const char* image = offsets + offsets_size;
+	if (len < sizeof(reply) + offsets_size
+		|| reply.size != len - sizeof(reply) - offsets_size
+		|| buflen < padding || reply.size > buflen - padding
+		|| reply.mem % _Alignof(char*) != 0
+		|| reply.mem + (reply.count + 1) * sizeof(char*) > reply.size) {
+		return false;
+	}
+	buffer += padding;
+	if (! nss_mtl_protocol_pointer(image, reply.size, reply.name, buffer, &grp->gr_name)
+		|| ! nss_mtl_protocol_pointer(image, reply.size, reply.passwd, buffer, &grp->gr_passwd)) {
+		return false;
+	}
+
+	memcpy(buffer, image, reply.size);
+	char** mem = (char**)(buffer + reply.mem);
+	for (uint32_t i = 0; i < reply.count; ++i) {
+		uint32_t offset = 0;
+		memcpy(&offset, offsets + i * sizeof(uint32_t), sizeof(uint32_t));
+		if (! nss_mtl_protocol_pointer(image, reply.size, offset, buffer, &mem[i])) {
+			return false;
+		}
+	}
+	mem[reply.count] = NULL;
+	grp->gr_mem = mem;
+	grp->gr_gid = reply.gid;
+
+	return true;
+}
\ No newline at end of file
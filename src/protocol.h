@@ -0,0 +1,128 @@
+/*
+ * protocol.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_PROTOCOL_H
+#define NSS_MTL_PROTOCOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pwd.h>
+#include <grp.h>
+#include <shadow.h>
+
+#ifndef NSS_MTL_SOCKET_FILE
+#define NSS_MTL_SOCKET_FILE "/run/nss_mtl/socket"
+#endif
+
+#define NSS_MTL_PROTOCOL_VERSION 1
+
+/* largest caller buffer nss_mtld works with, clients fall back to in-process lookup above it */
+#define NSS_MTL_PROTOCOL_MAX_BUFFER (1024 * 1024)
+#define NSS_MTL_PROTOCOL_MAX_STRING 1024
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	NSS_MTL_REQUEST_PWNAM = 1,
+	NSS_MTL_REQUEST_SPNAM,
+	NSS_MTL_REQUEST_GRNAM,
+	NSS_MTL_REQUEST_GRGID,
+	NSS_MTL_REQUEST_INITGROUPS,
+} nss_mtl_request_type_t;
+
+/* followed by key, exec and session user strings, without terminating NULs */
+typedef struct {
+	uint32_t version;
+	uint32_t type;
+	uint32_t gid;
+	uint32_t buflen;
+	uint32_t key_length;
+	uint32_t exec_length;
+	uint32_t session_length;
+} nss_mtl_request_t;
+
+/* followed by length bytes of payload, present only on success */
+typedef struct {
+	int32_t status;
+	int32_t errnop;
+	uint32_t length;
+} nss_mtl_response_t;
+
+/*
+ * Payloads carry the caller's buffer image as filled by the lookup,
+ * with pointers replaced by offsets into that image.
+ */
+typedef struct {
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t name;
+	uint32_t passwd;
+	uint32_t gecos;
+	uint32_t dir;
+	uint32_t shell;
+	uint32_t size;
+} nss_mtl_reply_passwd_t;
+
+typedef struct {
+	int64_t lstchg;
+	int64_t min;
+	int64_t max;
+	int64_t warn;
+	int64_t inact;
+	int64_t expire;
+	uint64_t flag;
+	uint32_t namp;
+	uint32_t pwdp;
+	uint32_t size;
+} nss_mtl_reply_spwd_t;
+
+/* followed by count member offsets, then the image */
+typedef struct {
+	uint32_t gid;
+	uint32_t name;
+	uint32_t passwd;
+	uint32_t mem;
+	uint32_t count;
+	uint32_t size;
+} nss_mtl_reply_group_t;
+
+/* followed by count gids */
+typedef struct {
+	uint32_t count;
+} nss_mtl_reply_groups_t;
+
+/* deadlines bound a whole exchange, however slowly the peer trickles its data */
+uint64_t nss_mtl_protocol_deadline(unsigned int timeout_ms);
+bool nss_mtl_protocol_send(int fd, const void* data, size_t len, uint64_t deadline);
+bool nss_mtl_protocol_recv(int fd, void* data, size_t len, uint64_t deadline);
+
+size_t nss_mtl_protocol_passwd_pack(const struct passwd* pw, const char* buffer, size_t buflen, char** payload);
+bool nss_mtl_protocol_passwd_unpack(const char* payload, size_t len, struct passwd* pw, char* buffer, size_t buflen);
+size_t nss_mtl_protocol_spwd_pack(const struct spwd* spw, const char* buffer, size_t buflen, char** payload);
+bool nss_mtl_protocol_spwd_unpack(const char* payload, size_t len, struct spwd* spw, char* buffer, size_t buflen);
+size_t nss_mtl_protocol_group_pack(const struct group* grp, const char* buffer, size_t buflen, char** payload);
+bool nss_mtl_protocol_group_unpack(const char* payload, size_t len, struct group* grp, char* buffer, size_t buflen);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_PROTOCOL_H */
\ No newline at end of file
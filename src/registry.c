@@ -0,0 +1,328 @@
+/*
+ * registry.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "registry.h"
+
+/* how many times reader retries an entry being written before skipping it */
+#define NSS_MTL_REGISTRY_RETRIES 64
+
+static bool nss_mtl_registry_alive(pid_t pid);
+static void nss_mtl_registry_name_store(nss_mtl_registry_entry_t* entry, const char* user, size_t len);
+static void nss_mtl_registry_name_load(nss_mtl_registry_entry_t* entry, char* user);
+static bool nss_mtl_registry_entry_read(const nss_mtl_registry_entry_t* entry, pid_t* pid, char* user);
+static void nss_mtl_registry_changed(nss_mtl_registry_t* registry);
+static void nss_mtl_registry_view_destroy(nss_mtl_snapshot_t* snapshot);
+static bool nss_mtl_registry_view_current(const nss_mtl_snapshot_t* snapshot, const struct stat* st);
+
+static nss_mtl_snapshot_slot_t nss_mtl_registry_slot = NSS_MTL_SNAPSHOT_SLOT_INIT;
+
+/* implementation */
+
+bool nss_mtl_registry_alive(pid_t pid) {
+	/* EPERM still means there is such a process */
+	return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+void nss_mtl_registry_name_store(nss_mtl_registry_entry_t* entry, const char* user, size_t len) {
+	/* release, so that readers seeing any part of the name see odd seq as well */
+	uint64_t words[NSS_MTL_REGISTRY_NAME_SIZE / sizeof(uint64_t)] = { 0 };
+	memcpy(words, user, len);
+	for (size_t i = 0; i < NSS_MTL_REGISTRY_NAME_SIZE / sizeof(uint64_t); ++i) {
+		atomic_store_explicit(&entry->user[i], words[i], memory_order_release);
+	}
+}
+
+void nss_mtl_registry_name_load(nss_mtl_registry_entry_t* entry, char* user) {
+	/* acquire, so that seq read afterwards is not read before the name */
+	uint64_t words[NSS_MTL_REGISTRY_NAME_SIZE / sizeof(uint64_t)];
+	for (size_t i = 0; i < NSS_MTL_REGISTRY_NAME_SIZE / sizeof(uint64_t); ++i) {
+		words[i] = atomic_load_explicit(&entry->user[i], memory_order_acquire);
+	}
+	memcpy(user, words, NSS_MTL_REGISTRY_NAME_SIZE);
+	user[NSS_MTL_REGISTRY_NAME_SIZE - 1] = '\0';
+}
+
+bool nss_mtl_registry_entry_read(const nss_mtl_registry_entry_t* entry, pid_t* pid, char* user) {
+	nss_mtl_registry_entry_t* e = (nss_mtl_registry_entry_t*)entry;
+	for (int i = 0; i < NSS_MTL_REGISTRY_RETRIES; ++i) {
+		const uint32_t seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+		if (seq & 1) {
+			continue;
+		}
+		*pid = atomic_load_explicit(&e->pid, memory_order_acquire);
+		nss_mtl_registry_name_load(e, user);
+		if (atomic_load_explicit(&e->seq, memory_order_relaxed) == seq) {
+			return *pid != 0;
+		}
+	}
+
+	/* writer which died in the middle leaves the entry odd forever */
+	return false;
+}
+
+void nss_mtl_registry_changed(nss_mtl_registry_t* registry) {
+	atomic_fetch_add_explicit(&registry->generation, 1, memory_order_release);
+}
+
+nss_mtl_registry_t* nss_mtl_registry_map(const char* path, bool writable) {
+	if (writable) {
+		char dir[PATH_MAX];
+		strncpy(dir, path, sizeof(dir) - 1);
+		dir[sizeof(dir) - 1] = '\0';
+		if (mkdir(dirname(dir), 0755) == -1 && errno != EEXIST) {
+			nss_mtl_utils_log(LOG_WARNING, "%s: cannot create directory for %s: %m", __func__, path);
+			return NULL;
+		}
+	}
+
+	int fd = open(path, (writable ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		if (errno != ENOENT && errno != EACCES) {
+			nss_mtl_utils_log(LOG_WARNING, "%s: cannot open %s: %m", __func__, path);
+		}
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || (writable && st.st_size == 0 && ftruncate(fd, sizeof(nss_mtl_registry_t)) == -1)) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: cannot prepare %s: %m", __func__, path);
+		close(fd);
+		return NULL;
+	}
+	if ((st.st_size != 0 || ! writable) && (size_t)st.st_size != sizeof(nss_mtl_registry_t)) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: %s has unexpected size %ld", __func__, path, (long)st.st_size);
+		close(fd);
+		return NULL;
+	}
+
+	void* addr = mmap(NULL, sizeof(nss_mtl_registry_t), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: cannot map %s: %m", __func__, path);
+		return NULL;
+	}
+
+	nss_mtl_registry_t* registry = addr;
+	if (writable && atomic_load_explicit(&registry->magic, memory_order_acquire) == 0) {
+		registry->version = NSS_MTL_REGISTRY_VERSION;
+		registry->slots = NSS_MTL_REGISTRY_SLOTS;
+		atomic_store_explicit(&registry->magic, NSS_MTL_REGISTRY_MAGIC, memory_order_release);
+	}
+
+	if (atomic_load_explicit(&registry->magic, memory_order_acquire) != NSS_MTL_REGISTRY_MAGIC || registry->version != NSS_MTL_REGISTRY_VERSION || registry->slots != NSS_MTL_REGISTRY_SLOTS) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: %s has incompatible layout", __func__, path);
+		munmap(addr, sizeof(nss_mtl_registry_t));
+		return NULL;
+	}
+
+	return registry;
+}
+
+void nss_mtl_registry_unmap(const nss_mtl_registry_t* registry) {
+	if (registry != NULL) {
+		munmap((void*)registry, sizeof(nss_mtl_registry_t));
+	}
+}
+
+bool nss_mtl_registry_add(nss_mtl_registry_t* registry, const char* user, pid_t pid) {
+	assert(registry != NULL);
+	assert(user != NULL);
+
+	const size_t len = strlen(user);
+	if (len == 0 || len >= NSS_MTL_REGISTRY_NAME_SIZE) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: cannot register user %s, name too long", __func__, user);
+		return false;
+	}
+
+	for (uint32_t i = 0; i < NSS_MTL_REGISTRY_SLOTS; ++i) {
+		nss_mtl_registry_entry_t* entry = &registry->entries[i];
+		uint32_t seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+		if (seq & 1) {
+			continue;
+		}
+		/* entries of sessions which ended without closing are taken over */
+		const pid_t owner = atomic_load_explicit(&entry->pid, memory_order_relaxed);
+		if (owner != 0 && nss_mtl_registry_alive(owner)) {
+			continue;
+		}
+		/* nobody wrote the entry since it was looked at, as long as seq did not change */
+		if (! atomic_compare_exchange_strong_explicit(&entry->seq, &seq, seq + 1, memory_order_acquire, memory_order_relaxed)) {
+			continue;
+		}
+
+		atomic_store_explicit(&entry->pid, pid, memory_order_release);
+		nss_mtl_registry_name_store(entry, user, len);
+		atomic_store_explicit(&entry->seq, seq + 2, memory_order_release);
+
+		uint32_t high = atomic_load_explicit(&registry->high, memory_order_relaxed);
+		while (high < i + 1 && ! atomic_compare_exchange_weak_explicit(&registry->high, &high, i + 1, memory_order_release, memory_order_relaxed)) {
+			/* high only grows */
+		}
+		nss_mtl_registry_changed(registry);
+		return true;
+	}
+
+	nss_mtl_utils_log(LOG_WARNING, "%s: cannot register user %s, all %d entries in use", __func__, user, NSS_MTL_REGISTRY_SLOTS);
+	return false;
+}
+
+bool nss_mtl_registry_remove(nss_mtl_registry_t* registry, const char* user, pid_t pid) {
+	assert(registry != NULL);
+	assert(user != NULL);
+
+	const uint32_t high = atomic_load_explicit(&registry->high, memory_order_acquire);
+	pid_t owner = 0;
+	char name[NSS_MTL_REGISTRY_NAME_SIZE];
+	for (uint32_t i = 0; i < high; ++i) {
+		nss_mtl_registry_entry_t* entry = &registry->entries[i];
+		uint32_t seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+		if ((seq & 1) || ! nss_mtl_registry_entry_read(entry, &owner, name) || owner != pid || strcmp(name, user) != 0) {
+			continue;
+		}
+		/* fails when the entry changed since it was read */
+		if (! atomic_compare_exchange_strong_explicit(&entry->seq, &seq, seq + 1, memory_order_acquire, memory_order_relaxed)) {
+			continue;
+		}
+
+		atomic_store_explicit(&entry->pid, 0, memory_order_release);
+		nss_mtl_registry_name_store(entry, "", 0);
+		atomic_store_explicit(&entry->seq, seq + 2, memory_order_release);
+		nss_mtl_registry_changed(registry);
+		return true;
+	}
+
+	nss_mtl_utils_log(LOG_DEBUG, "%s: session of user %s from process %d not registered", __func__, user, (int)pid);
+	return false;
+}
+
+uint64_t nss_mtl_registry_generation(const nss_mtl_registry_t* registry) {
+	return atomic_load_explicit(&((nss_mtl_registry_t*)registry)->generation, memory_order_acquire);
+}
+
+nss_mtl_utils_list_t* nss_mtl_registry_users(const nss_mtl_registry_t* registry, const nss_mtl_passwd_t* local, nss_mtl_arena_t* arena) {
+	assert(registry != NULL);
+	assert(local != NULL);
+
+	const uint32_t high = atomic_load_explicit(&((nss_mtl_registry_t*)registry)->high, memory_order_acquire);
+	nss_mtl_utils_list_t* lst = nss_mtl_utils_list_alloc(arena, high);
+	if (lst == NULL) {
+		return NULL;
+	}
+
+	pid_t pid = 0;
+	char user[NSS_MTL_REGISTRY_NAME_SIZE];
+	for (uint32_t i = 0; i < high; ++i) {
+		if (! nss_mtl_registry_entry_read(&registry->entries[i], &pid, user) || ! nss_mtl_registry_alive(pid)) {
+			continue;
+		}
+		if (nss_mtl_passwd_contains(local, user)) {
+			nss_mtl_utils_log(LOG_DEBUG, "%s: ignoring local user %s", __func__, user);
+			continue;
+		}
+		if (! nss_mtl_utils_list_add(lst, user, strlen(user))) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for user %s", __func__, user);
+			return NULL;
+		}
+	}
+
+	/* same user may have several sessions */
+	nss_mtl_utils_list_uniq(lst);
+	nss_mtl_utils_log(LOG_DEBUG, "%s: found %lu active users", __func__, lst->filled);
+
+	return lst;
+}
+
+void nss_mtl_registry_view_destroy(nss_mtl_snapshot_t* snapshot) {
+	nss_mtl_registry_view_t* view = (nss_mtl_registry_view_t*)snapshot;
+
+	nss_mtl_registry_unmap(view->registry);
+	free(view);
+}
+
+bool nss_mtl_registry_view_current(const nss_mtl_snapshot_t* snapshot, const struct stat* st) {
+	/* mtime of a file written through mapping says nothing, only its identity matters */
+	return snapshot != NULL && snapshot->stamp.dev == st->st_dev && snapshot->stamp.ino == st->st_ino;
+}
+
+const nss_mtl_registry_view_t* nss_mtl_registry_acquire(void) {
+	/* file appears with the first registered session, so keep looking until then */
+	struct stat st;
+	if (stat(NSS_MTL_REGISTRY_FILE, &st) == -1) {
+		if (errno != ENOENT && errno != EACCES) {
+			nss_mtl_utils_log(LOG_WARNING, "%s: cannot stat %s: %m", __func__, NSS_MTL_REGISTRY_FILE);
+		}
+		return NULL;
+	}
+
+	nss_mtl_snapshot_t* snapshot = nss_mtl_snapshot_acquire(&nss_mtl_registry_slot);
+	if (nss_mtl_registry_view_current(snapshot, &st)) {
+		return (nss_mtl_registry_view_t*)snapshot;
+	}
+	nss_mtl_snapshot_release(snapshot);
+
+	/* another thread may have mapped it in the meantime */
+	pthread_mutex_lock(&nss_mtl_registry_slot.lock);
+	snapshot = atomic_load(&nss_mtl_registry_slot.current);
+	if (nss_mtl_registry_view_current(snapshot, &st)) {
+		nss_mtl_snapshot_retain(snapshot);
+		pthread_mutex_unlock(&nss_mtl_registry_slot.lock);
+		return (nss_mtl_registry_view_t*)snapshot;
+	}
+	pthread_mutex_unlock(&nss_mtl_registry_slot.lock);
+
+	nss_mtl_registry_view_t* view = calloc(1, sizeof(nss_mtl_registry_view_t));
+	if (view == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate registry view", __func__);
+		return NULL;
+	}
+	/* file replaced between stat() and open() is noticed on the next call */
+	view->registry = nss_mtl_registry_map(NSS_MTL_REGISTRY_FILE, false);
+	if (view->registry == NULL) {
+		free(view);
+		return NULL;
+	}
+	nss_mtl_snapshot_init(&view->snapshot, nss_mtl_registry_view_destroy);
+	view->snapshot.stamp.dev = st.st_dev;
+	view->snapshot.stamp.ino = st.st_ino;
+	nss_mtl_utils_log(LOG_DEBUG, "%s: mapped %s", __func__, NSS_MTL_REGISTRY_FILE);
+	/* previous mapping goes away with the last thread still reading it */
+	nss_mtl_snapshot_publish(&nss_mtl_registry_slot, &view->snapshot);
+
+	return view;
+}
+
+void nss_mtl_registry_release(const nss_mtl_registry_view_t* view) {
+	if (view != NULL) {
+		nss_mtl_snapshot_release((nss_mtl_snapshot_t*)&view->snapshot);
+	}
+}
\ No newline at end of file
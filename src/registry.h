@@ -0,0 +1,97 @@
+/*
+ * registry.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_REGISTRY_H
+#define NSS_MTL_REGISTRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#include "passwd.h"
+#include "snapshot.h"
+#include "utils.h"
+
+#ifndef NSS_MTL_REGISTRY_FILE
+#define NSS_MTL_REGISTRY_FILE "/run/nss_mtl/sessions"
+#endif
+
+#define NSS_MTL_REGISTRY_MAGIC 0x6772746du
+#define NSS_MTL_REGISTRY_VERSION 1
+
+#define NSS_MTL_REGISTRY_SLOTS 4096
+/* longer names are not registered, utmp keeps even less */
+#define NSS_MTL_REGISTRY_NAME_SIZE 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Session of a single user, guarded by a sequence lock: seq is odd while
+ * the entry is written, so readers retry when it changes under them and
+ * writers own the entry by moving seq from even to odd. Fields are atomic
+ * words, since readers look at them while they may be written. Free
+ * entries have pid 0.
+ */
+typedef struct {
+	_Atomic uint32_t seq;
+	_Atomic int32_t pid;
+	_Atomic uint64_t user[NSS_MTL_REGISTRY_NAME_SIZE / sizeof(uint64_t)];
+} nss_mtl_registry_entry_t;
+
+/* layout of NSS_MTL_REGISTRY_FILE, written by pam_mtl and read by all processes using the module */
+typedef struct {
+	_Atomic uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	/* entries at or above it were never used, so that readers look only at those below */
+	_Atomic uint32_t high;
+	/* bumped on every change */
+	_Atomic uint64_t generation;
+	nss_mtl_registry_entry_t entries[NSS_MTL_REGISTRY_SLOTS];
+} nss_mtl_registry_t;
+
+/* NSS_MTL_REGISTRY_FILE mapped for reading, stamped with its dev and ino only */
+typedef struct {
+	nss_mtl_snapshot_t snapshot;
+	const nss_mtl_registry_t* registry;
+} nss_mtl_registry_view_t;
+
+nss_mtl_registry_t* nss_mtl_registry_map(const char* path, bool writable);
+void nss_mtl_registry_unmap(const nss_mtl_registry_t* registry);
+bool nss_mtl_registry_add(nss_mtl_registry_t* registry, const char* user, pid_t pid);
+bool nss_mtl_registry_remove(nss_mtl_registry_t* registry, const char* user, pid_t pid);
+uint64_t nss_mtl_registry_generation(const nss_mtl_registry_t* registry);
+nss_mtl_utils_list_t* nss_mtl_registry_users(const nss_mtl_registry_t* registry, const nss_mtl_passwd_t* local, nss_mtl_arena_t* arena);
+
+/*
+ * NSS_MTL_REGISTRY_FILE mapped for reading, or NULL when nobody registers
+ * sessions. File recreated in the meantime, e.g. after /run was cleaned, is
+ * mapped anew.
+ */
+const nss_mtl_registry_view_t* nss_mtl_registry_acquire(void);
+void nss_mtl_registry_release(const nss_mtl_registry_view_t* view);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_REGISTRY_H */
\ No newline at end of file
@@ -0,0 +1,211 @@
+/*
+ * session.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+#include "session.h"
+#include "passwd.h"
+#include "registry.h"
+
+/* first guess only, later snapshots are sized after the previous one */
+#define NSS_MTL_SESSION_ARENA_SIZE 16384
+/* how long registry sessions are trusted without checking their processes are still alive, in seconds */
+#define NSS_MTL_SESSION_REGISTRY_TTL 10
+
+static bool nss_mtl_session_stamp_read(const nss_mtl_registry_view_t* view, nss_mtl_utils_stamp_t* stamp);
+static nss_mtl_session_t* nss_mtl_session_load(const nss_mtl_config_t* config, const nss_mtl_registry_t* registry, const nss_mtl_passwd_t* passwd);
+static bool nss_mtl_session_pack(const nss_mtl_config_t* config, nss_mtl_session_t* session);
+static void nss_mtl_session_destroy(nss_mtl_snapshot_t* snapshot);
+
+static nss_mtl_snapshot_slot_t nss_mtl_session_slot = NSS_MTL_SNAPSHOT_SLOT_INIT;
+static atomic_size_t nss_mtl_session_arena_size = NSS_MTL_SESSION_ARENA_SIZE;
+
+/* implementation */
+
+bool nss_mtl_session_stamp_read(const nss_mtl_registry_view_t* view, nss_mtl_utils_stamp_t* stamp) {
+	if (view != NULL) {
+		/* registry counts its changes, which stands for file size here */
+		memset(stamp, 0, sizeof(nss_mtl_utils_stamp_t));
+		stamp->dev = view->snapshot.stamp.dev;
+		stamp->ino = view->snapshot.stamp.ino;
+		stamp->size = nss_mtl_registry_generation(view->registry);
+		/* sessions whose process died without closing them change nothing, so they are looked for every now and then */
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		stamp->mtime.tv_sec = ts.tv_sec / NSS_MTL_SESSION_REGISTRY_TTL;
+		return true;
+	}
+
+	struct stat st;
+	if (stat(NSS_MTL_UTMP_FILE, &st) == -1) {
+		if (errno != ENOENT) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot stat %s: %m", __func__, NSS_MTL_UTMP_FILE);
+			return false;
+		}
+		/* no utmp means no sessions, which is worth caching as well */
+		memset(stamp, 0, sizeof(nss_mtl_utils_stamp_t));
+		return true;
+	}
+
+	nss_mtl_utils_stamp_fill(stamp, &st);
+	return true;
+}
+
+nss_mtl_session_t* nss_mtl_session_load(const nss_mtl_config_t* config, const nss_mtl_registry_t* registry, const nss_mtl_passwd_t* passwd) {
+	nss_mtl_arena_t* arena = nss_mtl_arena_create(atomic_load_explicit(&nss_mtl_session_arena_size, memory_order_relaxed));
+	nss_mtl_session_t* session = arena != NULL ? nss_mtl_arena_calloc(arena, 1, sizeof(nss_mtl_session_t)) : NULL;
+	if (session == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate session snapshot", __func__);
+		nss_mtl_arena_destroy(arena);
+		return NULL;
+	}
+	nss_mtl_snapshot_init(&session->snapshot, nss_mtl_session_destroy);
+	session->arena = arena;
+	session->config_generation = config->snapshot.generation;
+	session->passwd_generation = passwd->snapshot.generation;
+
+	/* sessions registered by pam_mtl make utmp parsing unnecessary */
+	session->users = registry != NULL ? nss_mtl_registry_users(registry, passwd, arena) : nss_mtl_utils_users_read(passwd, arena);
+	if (session->users == NULL || ! nss_mtl_session_pack(config, session)) {
+		nss_mtl_arena_destroy(arena);
+		return NULL;
+	}
+	/* with some room for sessions opened in the meantime */
+	const size_t used = nss_mtl_arena_used(arena);
+	atomic_store_explicit(&nss_mtl_session_arena_size, used + used / 4, memory_order_relaxed);
+
+	return session;
+}
+
+bool nss_mtl_session_pack(const nss_mtl_config_t* config, nss_mtl_session_t* session) {
+	const nss_mtl_utils_list_t* users = session->users;
+
+	session->targets = nss_mtl_arena_alloc(session->arena, (users->filled + 1) * sizeof(size_t));
+	if (session->targets == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for %lu active users", __func__, users->filled);
+		return false;
+	}
+
+	size_t sizes[NSS_MTL_CONFIG_MAX_TARGETS] = { 0 };
+	for (size_t i = 0; i < users->filled; ++i) {
+		const size_t target = nss_mtl_config_target(config, users->items[i]);
+		session->targets[i] = target;
+		session->blocks[target].count += 1;
+		sizes[target] += strlen(users->items[i]) + 1;
+	}
+
+	for (size_t target = 0; target < config->targets_count; ++target) {
+		nss_mtl_session_block_t* block = &session->blocks[target];
+		/* never empty, so that copying the block needs no special case */
+		block->block = nss_mtl_arena_alloc(session->arena, sizes[target] + 1);
+		block->offsets = nss_mtl_arena_alloc(session->arena, (block->count + 1) * sizeof(size_t));
+		if (block->block == NULL || block->offsets == NULL) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for %lu active users of %s", __func__, block->count, config->targets[target]);
+			return false;
+		}
+		block->block_size = 0;
+		block->count = 0;
+	}
+
+	/* users stay sorted within every block */
+	for (size_t i = 0; i < users->filled; ++i) {
+		nss_mtl_session_block_t* block = &session->blocks[session->targets[i]];
+		block->offsets[block->count++] = block->block_size;
+		block->block_size = stpcpy(block->block + block->block_size, users->items[i]) + 1 - block->block;
+	}
+
+	return true;
+}
+
+void nss_mtl_session_destroy(nss_mtl_snapshot_t* snapshot) {
+	nss_mtl_session_t* session = (nss_mtl_session_t*)snapshot;
+
+	nss_mtl_arena_destroy(session->arena);
+}
+
+const nss_mtl_session_t* nss_mtl_session_acquire(const nss_mtl_config_t* config) {
+	assert(config != NULL);
+
+	const nss_mtl_registry_view_t* view = nss_mtl_registry_acquire();
+	nss_mtl_utils_stamp_t stamp;
+	if (! nss_mtl_session_stamp_read(view, &stamp)) {
+		return NULL;
+	}
+
+	/* local users are filtered out, so passwd changes invalidate the snapshot too */
+	const nss_mtl_passwd_t* passwd = nss_mtl_passwd_acquire();
+	if (passwd == NULL) {
+		nss_mtl_registry_release(view);
+		return NULL;
+	}
+
+	nss_mtl_session_t* session = (nss_mtl_session_t*)nss_mtl_snapshot_acquire(&nss_mtl_session_slot);
+	if (session != NULL) {
+		/* users are split among targets by map rules, so config changes invalidate the snapshot as well */
+		if (nss_mtl_utils_stamp_equal(&session->snapshot.stamp, &stamp) && session->passwd_generation == passwd->snapshot.generation
+			&& session->config_generation == config->snapshot.generation) {
+			nss_mtl_passwd_release(passwd);
+			nss_mtl_registry_release(view);
+			return session;
+		}
+		nss_mtl_utils_log(LOG_DEBUG, "%s: %s changed, reloading", __func__, view != NULL ? NSS_MTL_REGISTRY_FILE : NSS_MTL_UTMP_FILE);
+		nss_mtl_session_release(session);
+	}
+
+	session = nss_mtl_session_load(config, view != NULL ? view->registry : NULL, passwd);
+	nss_mtl_passwd_release(passwd);
+	nss_mtl_registry_release(view);
+	if (session == NULL) {
+		return NULL;
+	}
+	session->snapshot.stamp = stamp;
+	nss_mtl_snapshot_publish(&nss_mtl_session_slot, &session->snapshot);
+
+	return session;
+}
+
+void nss_mtl_session_release(const nss_mtl_session_t* session) {
+	if (session != NULL) {
+		nss_mtl_snapshot_release((nss_mtl_snapshot_t*)&session->snapshot);
+	}
+}
+
+bool nss_mtl_session_contains(const nss_mtl_session_t* session, const char* user) {
+	const nss_mtl_utils_list_t* users = session->users;
+	return bsearch(&user, users->items, users->filled, sizeof(char*), nss_mtl_utils_strptr_cmp) != NULL;
+}
+
+bool nss_mtl_session_target(const nss_mtl_session_t* session, const char* user, size_t* target) {
+	const nss_mtl_utils_list_t* users = session->users;
+	char** found = bsearch(&user, users->items, users->filled, sizeof(char*), nss_mtl_utils_strptr_cmp);
+	if (found == NULL) {
+		return false;
+	}
+
+	*target = session->targets[found - users->items];
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+/*
+ * session.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_SESSION_H
+#define NSS_MTL_SESSION_H
+
+#include <stdbool.h>
+
+#include "config.h"
+#include "snapshot.h"
+#include "utils.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* active users mapped onto one target, packed as "<name>\0<name>\0...", so that expanding a group is a single copy */
+typedef struct {
+	size_t count;
+	char* block;
+	size_t block_size;
+	size_t* offsets;
+} nss_mtl_session_block_t;
+
+/* non-local users with an active session, as registered by pam_mtl or found in utmp file */
+typedef struct {
+	nss_mtl_snapshot_t snapshot;
+	/* holds the session itself and everything it points to */
+	nss_mtl_arena_t* arena;
+	unsigned long config_generation;
+	unsigned long passwd_generation;
+	/* unique and sorted */
+	nss_mtl_utils_list_t* users;
+	/* target index of every user */
+	size_t* targets;
+	/* one per config target */
+	nss_mtl_session_block_t blocks[NSS_MTL_CONFIG_MAX_TARGETS];
+} nss_mtl_session_t;
+
+const nss_mtl_session_t* nss_mtl_session_acquire(const nss_mtl_config_t* config);
+void nss_mtl_session_release(const nss_mtl_session_t* session);
+bool nss_mtl_session_contains(const nss_mtl_session_t* session, const char* user);
+bool nss_mtl_session_target(const nss_mtl_session_t* session, const char* user, size_t* target);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_SESSION_H */
\ No newline at end of file
@@ -0,0 +1,144 @@
+/*
+ * snapshot.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <syslog.h>
+#include <sched.h>
+
+#include "snapshot.h"
+
+static void nss_mtl_snapshot_synchronize(nss_mtl_snapshot_slot_t* slot);
+static nss_mtl_snapshot_t* nss_mtl_snapshot_swap(nss_mtl_snapshot_slot_t* slot, nss_mtl_snapshot_t* snapshot);
+
+static atomic_ulong nss_mtl_snapshot_generation = 0;
+
+/* implementation */
+
+void nss_mtl_snapshot_init(nss_mtl_snapshot_t* snapshot, void (*destroy)(nss_mtl_snapshot_t* snapshot)) {
+	assert(snapshot != NULL);
+	assert(destroy != NULL);
+
+	atomic_init(&snapshot->refcount, 1);
+	memset(&snapshot->stamp, 0, sizeof(snapshot->stamp));
+	snapshot->generation = atomic_fetch_add(&nss_mtl_snapshot_generation, 1) + 1;
+	snapshot->destroy = destroy;
+}
+
+nss_mtl_snapshot_t* nss_mtl_snapshot_retain(nss_mtl_snapshot_t* snapshot) {
+	if (snapshot != NULL) {
+		atomic_fetch_add_explicit(&snapshot->refcount, 1, memory_order_relaxed);
+	}
+
+	return snapshot;
+}
+
+void nss_mtl_snapshot_release(nss_mtl_snapshot_t* snapshot) {
+	if (snapshot == NULL) {
+		return;
+	}
+
+	if (atomic_fetch_sub_explicit(&snapshot->refcount, 1, memory_order_acq_rel) == 1) {
+		snapshot->destroy(snapshot);
+	}
+}
+
+nss_mtl_snapshot_t* nss_mtl_snapshot_acquire(nss_mtl_snapshot_slot_t* slot) {
+	assert(slot != NULL);
+
+	/* publisher does not drop the slot reference until this reader leaves its epoch */
+	atomic_uint* readers = &slot->readers[atomic_load(&slot->epoch) & 1];
+	atomic_fetch_add(readers, 1);
+	nss_mtl_snapshot_t* snapshot = nss_mtl_snapshot_retain(atomic_load(&slot->current));
+	atomic_fetch_sub_explicit(readers, 1, memory_order_release);
+
+	return snapshot;
+}
+
+void nss_mtl_snapshot_synchronize(nss_mtl_snapshot_slot_t* slot) {
+	/* a reader may have registered in either epoch, so both have to drain */
+	for (int i = 0; i < 2; ++i) {
+		const unsigned int epoch = atomic_fetch_add(&slot->epoch, 1);
+		while (atomic_load(&slot->readers[epoch & 1]) != 0) {
+			sched_yield();
+		}
+	}
+}
+
+nss_mtl_snapshot_t* nss_mtl_snapshot_swap(nss_mtl_snapshot_slot_t* slot, nss_mtl_snapshot_t* snapshot) {
+	/* slot holds its own reference, caller keeps the one it already has */
+	nss_mtl_snapshot_retain(snapshot);
+	nss_mtl_snapshot_t* old = atomic_exchange(&slot->current, snapshot);
+	nss_mtl_snapshot_synchronize(slot);
+
+	return old;
+}
+
+void nss_mtl_snapshot_publish(nss_mtl_snapshot_slot_t* slot, nss_mtl_snapshot_t* snapshot) {
+	assert(slot != NULL);
+
+	pthread_mutex_lock(&slot->lock);
+	nss_mtl_snapshot_t* old = nss_mtl_snapshot_swap(slot, snapshot);
+	pthread_mutex_unlock(&slot->lock);
+
+	nss_mtl_snapshot_release(old);
+}
+
+nss_mtl_snapshot_t* nss_mtl_snapshot_acquire_file(nss_mtl_snapshot_slot_t* slot, const char* path, nss_mtl_snapshot_t* (*load)(const char* path)) {
+	assert(slot != NULL);
+	assert(path != NULL);
+	assert(load != NULL);
+
+	nss_mtl_utils_stamp_t stamp;
+	if (! nss_mtl_utils_stamp_read(path, &stamp)) {
+		return NULL;
+	}
+
+	nss_mtl_snapshot_t* snapshot = nss_mtl_snapshot_acquire(slot);
+	if (snapshot != NULL) {
+		if (nss_mtl_utils_stamp_equal(&snapshot->stamp, &stamp)) {
+			return snapshot;
+		}
+		nss_mtl_snapshot_release(snapshot);
+	}
+
+	/* only one thread reloads, the others wait and pick up its result */
+	pthread_mutex_lock(&slot->lock);
+	snapshot = atomic_load(&slot->current);
+	if (snapshot != NULL && nss_mtl_utils_stamp_equal(&snapshot->stamp, &stamp)) {
+		nss_mtl_snapshot_retain(snapshot);
+		pthread_mutex_unlock(&slot->lock);
+		return snapshot;
+	}
+
+	nss_mtl_utils_log(LOG_DEBUG, "%s: loading %s", __func__, path);
+	/* stamp is taken before loading, so a concurrent edit triggers another reload */
+	snapshot = load(path);
+	if (snapshot == NULL) {
+		pthread_mutex_unlock(&slot->lock);
+		return NULL;
+	}
+	snapshot->stamp = stamp;
+	nss_mtl_snapshot_t* old = nss_mtl_snapshot_swap(slot, snapshot);
+	pthread_mutex_unlock(&slot->lock);
+
+	nss_mtl_snapshot_release(old);
+	return snapshot;
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+/*
+ * snapshot.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_SNAPSHOT_H
+#define NSS_MTL_SNAPSHOT_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Immutable, reference-counted object cached for the whole process.
+ * Must be the first member of the structure it describes.
+ */
+typedef struct nss_mtl_snapshot {
+	atomic_uint refcount;
+	unsigned long generation;
+	nss_mtl_utils_stamp_t stamp;
+	void (*destroy)(struct nss_mtl_snapshot* snapshot);
+} nss_mtl_snapshot_t;
+
+/* place holding the most recently published snapshot */
+/*
+ * Readers register in one of two epoch counters for the short time between
+ * loading current snapshot and taking a reference to it. Writers are serialized
+ * by lock and wait for both counters to drain before dropping replaced snapshot.
+ */
+typedef struct {
+	_Atomic(nss_mtl_snapshot_t*) current;
+	atomic_uint epoch;
+	atomic_uint readers[2];
+	pthread_mutex_t lock;
+} nss_mtl_snapshot_slot_t;
+
+#define NSS_MTL_SNAPSHOT_SLOT_INIT { NULL, 0, { 0, 0 }, PTHREAD_MUTEX_INITIALIZER }
+
+void nss_mtl_snapshot_init(nss_mtl_snapshot_t* snapshot, void (*destroy)(nss_mtl_snapshot_t* snapshot));
+nss_mtl_snapshot_t* nss_mtl_snapshot_retain(nss_mtl_snapshot_t* snapshot);
+void nss_mtl_snapshot_release(nss_mtl_snapshot_t* snapshot);
+
+nss_mtl_snapshot_t* nss_mtl_snapshot_acquire(nss_mtl_snapshot_slot_t* slot);
+void nss_mtl_snapshot_publish(nss_mtl_snapshot_slot_t* slot, nss_mtl_snapshot_t* snapshot);
+nss_mtl_snapshot_t* nss_mtl_snapshot_acquire_file(nss_mtl_snapshot_slot_t* slot, const char* path, nss_mtl_snapshot_t* (*load)(const char* path));
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_SNAPSHOT_H */
\ No newline at end of file
@@ -0,0 +1,210 @@
+/*
+ * stats.c
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+#include "utils.h"
+
+static void nss_mtl_stats_attach(void);
+static uint64_t nss_mtl_stats_now(void);
+
+static const char* nss_mtl_stats_op_names[NSS_MTL_STATS_OPS] = {
+	[NSS_MTL_STATS_GETPWNAM] = "getpwnam",
+	[NSS_MTL_STATS_GETSPNAM] = "getspnam",
+	[NSS_MTL_STATS_GETGRNAM] = "getgrnam",
+	[NSS_MTL_STATS_GETGRGID] = "getgrgid",
+	[NSS_MTL_STATS_GETGRENT] = "getgrent",
+	[NSS_MTL_STATS_INITGROUPS] = "initgroups",
+	[NSS_MTL_STATS_DAEMON] = "daemon",
+	[NSS_MTL_STATS_CONFIG_LOAD] = "config_load",
+	[NSS_MTL_STATS_PASSWD_LOAD] = "passwd_load",
+	[NSS_MTL_STATS_GROUP_LOAD] = "group_load",
+	[NSS_MTL_STATS_UTMP_READ] = "utmp_read",
+};
+
+static pthread_once_t nss_mtl_stats_once = PTHREAD_ONCE_INIT;
+static nss_mtl_stats_t* nss_mtl_stats = NULL;
+
+/* implementation */
+
+void nss_mtl_stats_attach(void) {
+	/* file is created by mtl-stat, processes which cannot write it simply do not record */
+	nss_mtl_stats = nss_mtl_stats_map(NSS_MTL_STATS_FILE, false);
+}
+
+uint64_t nss_mtl_stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t nss_mtl_stats_begin(void) {
+	pthread_once(&nss_mtl_stats_once, nss_mtl_stats_attach);
+	if (nss_mtl_stats == NULL) {
+		return 0;
+	}
+
+	return nss_mtl_stats_now();
+}
+
+void nss_mtl_stats_record(nss_mtl_stats_op_t op, uint64_t start, nss_mtl_stats_result_t result, size_t bytes) {
+	if (start == 0 || nss_mtl_stats == NULL) {
+		return;
+	}
+
+	const uint64_t elapsed = nss_mtl_stats_now() - start;
+	int bucket = 63 - __builtin_clzll(elapsed | 1);
+	if (bucket >= NSS_MTL_STATS_BUCKETS) {
+		bucket = NSS_MTL_STATS_BUCKETS - 1;
+	}
+	const int cpu = sched_getcpu();
+
+	nss_mtl_stats_counter_t* counter = &nss_mtl_stats->counters[(cpu > 0 ? cpu : 0) % NSS_MTL_STATS_SHARDS][op];
+	atomic_fetch_add_explicit(&counter->calls, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&counter->results[result], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&counter->nanoseconds, elapsed, memory_order_relaxed);
+	atomic_fetch_add_explicit(&counter->histogram[bucket], 1, memory_order_relaxed);
+	if (bytes > 0) {
+		atomic_fetch_add_explicit(&counter->bytes, bytes, memory_order_relaxed);
+	}
+}
+
+nss_mtl_stats_result_t nss_mtl_stats_result(enum nss_status status, int errnop) {
+	switch (status) {
+	case NSS_STATUS_SUCCESS:
+		return NSS_MTL_STATS_SUCCESS;
+	case NSS_STATUS_NOTFOUND:
+		return NSS_MTL_STATS_NOTFOUND;
+	case NSS_STATUS_TRYAGAIN:
+		return errnop == ERANGE ? NSS_MTL_STATS_ERANGE : NSS_MTL_STATS_TRYAGAIN;
+	default:
+		return NSS_MTL_STATS_UNAVAIL;
+	}
+}
+
+nss_mtl_stats_log_limit_t* nss_mtl_stats_log_limit(unsigned int cls) {
+	pthread_once(&nss_mtl_stats_once, nss_mtl_stats_attach);
+	if (nss_mtl_stats == NULL || cls >= NSS_MTL_STATS_LOG_LIMITS) {
+		return NULL;
+	}
+
+	return &nss_mtl_stats->log_limits[cls];
+}
+
+nss_mtl_stats_t* nss_mtl_stats_map(const char* path, bool create) {
+	int fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+	if (fd == -1) {
+		if (errno != ENOENT && errno != EACCES) {
+			nss_mtl_utils_log(LOG_WARNING, "%s: cannot open %s: %m", __func__, path);
+		}
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || (create && st.st_size == 0 && ftruncate(fd, sizeof(nss_mtl_stats_t)) == -1)) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: cannot prepare %s: %m", __func__, path);
+		close(fd);
+		return NULL;
+	}
+	/* file being created by another process is still empty, mapping it would fault on first access */
+	if ((st.st_size != 0 || ! create) && (size_t)st.st_size != sizeof(nss_mtl_stats_t)) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: %s has unexpected size %ld", __func__, path, (long)st.st_size);
+		close(fd);
+		return NULL;
+	}
+
+	void* addr = mmap(NULL, sizeof(nss_mtl_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: cannot map %s: %m", __func__, path);
+		return NULL;
+	}
+
+	nss_mtl_stats_t* stats = addr;
+	if (create && atomic_load_explicit(&stats->magic, memory_order_acquire) == 0) {
+		stats->version = NSS_MTL_STATS_VERSION;
+		stats->shards = NSS_MTL_STATS_SHARDS;
+		stats->ops = NSS_MTL_STATS_OPS;
+		atomic_store_explicit(&stats->magic, NSS_MTL_STATS_MAGIC, memory_order_release);
+	}
+
+	if (atomic_load_explicit(&stats->magic, memory_order_acquire) != NSS_MTL_STATS_MAGIC || stats->version != NSS_MTL_STATS_VERSION
+		|| stats->shards != NSS_MTL_STATS_SHARDS || stats->ops != NSS_MTL_STATS_OPS) {
+		nss_mtl_utils_log(LOG_WARNING, "%s: %s has incompatible layout", __func__, path);
+		munmap(addr, sizeof(nss_mtl_stats_t));
+		return NULL;
+	}
+
+	return stats;
+}
+
+void nss_mtl_stats_unmap(nss_mtl_stats_t* stats) {
+	if (stats != NULL) {
+		munmap(stats, sizeof(nss_mtl_stats_t));
+	}
+}
+
+void nss_mtl_stats_reset(nss_mtl_stats_t* stats) {
+	for (size_t shard = 0; shard < NSS_MTL_STATS_SHARDS; ++shard) {
+		for (size_t op = 0; op < NSS_MTL_STATS_OPS; ++op) {
+			nss_mtl_stats_counter_t* counter = &stats->counters[shard][op];
+			atomic_store(&counter->calls, 0);
+			for (size_t i = 0; i < NSS_MTL_STATS_RESULTS; ++i) {
+				atomic_store(&counter->results[i], 0);
+			}
+			atomic_store(&counter->nanoseconds, 0);
+			atomic_store(&counter->bytes, 0);
+			for (size_t i = 0; i < NSS_MTL_STATS_BUCKETS; ++i) {
+				atomic_store(&counter->histogram[i], 0);
+			}
+		}
+	}
+}
+
+void nss_mtl_stats_sum(const nss_mtl_stats_t* stats, nss_mtl_stats_op_t op, nss_mtl_stats_total_t* total) {
+	memset(total, 0, sizeof(nss_mtl_stats_total_t));
+	for (size_t shard = 0; shard < NSS_MTL_STATS_SHARDS; ++shard) {
+		nss_mtl_stats_counter_t* counter = (nss_mtl_stats_counter_t*)&stats->counters[shard][op];
+		total->calls += atomic_load_explicit(&counter->calls, memory_order_relaxed);
+		for (size_t i = 0; i < NSS_MTL_STATS_RESULTS; ++i) {
+			total->results[i] += atomic_load_explicit(&counter->results[i], memory_order_relaxed);
+		}
+		total->nanoseconds += atomic_load_explicit(&counter->nanoseconds, memory_order_relaxed);
+		total->bytes += atomic_load_explicit(&counter->bytes, memory_order_relaxed);
+		for (size_t i = 0; i < NSS_MTL_STATS_BUCKETS; ++i) {
+			total->histogram[i] += atomic_load_explicit(&counter->histogram[i], memory_order_relaxed);
+		}
+	}
+}
+
+const char* nss_mtl_stats_op_name(nss_mtl_stats_op_t op) {
+	return op < NSS_MTL_STATS_OPS ? nss_mtl_stats_op_names[op] : "unknown";
+}
\ No newline at end of file
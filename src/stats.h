@@ -0,0 +1,128 @@
+/*
+ * stats.h
+ *
+ * Copyright (c) 2024 Lukasz Krawiec
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NSS_MTL_STATS_H
+#define NSS_MTL_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <nss.h>
+
+#ifndef NSS_MTL_STATS_FILE
+#define NSS_MTL_STATS_FILE "/run/nss_mtl/stats"
+#endif
+
+#define NSS_MTL_STATS_MAGIC 0x736c746du
+#define NSS_MTL_STATS_VERSION 2
+
+/* counters are spread over shards picked by cpu to keep processes off each other's cache lines */
+#define NSS_MTL_STATS_SHARDS 16
+/* bucket n counts durations in [2^n, 2^(n+1)) nanoseconds */
+#define NSS_MTL_STATS_BUCKETS 32
+/* room for rate limits of log message classes */
+#define NSS_MTL_STATS_LOG_LIMITS 8
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	NSS_MTL_STATS_GETPWNAM = 0,
+	NSS_MTL_STATS_GETSPNAM,
+	NSS_MTL_STATS_GETGRNAM,
+	NSS_MTL_STATS_GETGRGID,
+	NSS_MTL_STATS_GETGRENT,
+	NSS_MTL_STATS_INITGROUPS,
+	NSS_MTL_STATS_DAEMON,
+	NSS_MTL_STATS_CONFIG_LOAD,
+	NSS_MTL_STATS_PASSWD_LOAD,
+	NSS_MTL_STATS_GROUP_LOAD,
+	NSS_MTL_STATS_UTMP_READ,
+	NSS_MTL_STATS_OPS,
+} nss_mtl_stats_op_t;
+
+typedef enum {
+	NSS_MTL_STATS_SUCCESS = 0,
+	NSS_MTL_STATS_NOTFOUND,
+	NSS_MTL_STATS_UNAVAIL,
+	NSS_MTL_STATS_TRYAGAIN,
+	NSS_MTL_STATS_ERANGE,
+	NSS_MTL_STATS_RESULTS,
+} nss_mtl_stats_result_t;
+
+typedef struct {
+	_Alignas(64) _Atomic uint64_t calls;
+	_Atomic uint64_t results[NSS_MTL_STATS_RESULTS];
+	_Atomic uint64_t nanoseconds;
+	_Atomic uint64_t bytes;
+	_Atomic uint64_t histogram[NSS_MTL_STATS_BUCKETS];
+} nss_mtl_stats_counter_t;
+
+/* rate limit of a single log message class */
+typedef struct {
+	/* start of current interval, in seconds, 0 when nothing was logged yet */
+	_Alignas(64) atomic_long window;
+	atomic_ulong suppressed;
+} nss_mtl_stats_log_limit_t;
+
+/* layout of NSS_MTL_STATS_FILE, shared by all processes using the module */
+typedef struct {
+	_Atomic uint32_t magic;
+	uint32_t version;
+	uint32_t shards;
+	uint32_t ops;
+	nss_mtl_stats_counter_t counters[NSS_MTL_STATS_SHARDS][NSS_MTL_STATS_OPS];
+	nss_mtl_stats_log_limit_t log_limits[NSS_MTL_STATS_LOG_LIMITS];
+} nss_mtl_stats_t;
+
+/* sum of all shards for a single op */
+typedef struct {
+	uint64_t calls;
+	uint64_t results[NSS_MTL_STATS_RESULTS];
+	uint64_t nanoseconds;
+	uint64_t bytes;
+	uint64_t histogram[NSS_MTL_STATS_BUCKETS];
+} nss_mtl_stats_total_t;
+
+/*
+ * Returns start timestamp for nss_mtl_stats_record(), or 0 when statistics
+ * are disabled, i.e. NSS_MTL_STATS_FILE could not be mapped for writing.
+ */
+uint64_t nss_mtl_stats_begin(void);
+void nss_mtl_stats_record(nss_mtl_stats_op_t op, uint64_t start, nss_mtl_stats_result_t result, size_t bytes);
+nss_mtl_stats_result_t nss_mtl_stats_result(enum nss_status status, int errnop);
+/*
+ * Returns rate limit of given log message class shared by all processes, or
+ * NULL when statistics are disabled.
+ */
+nss_mtl_stats_log_limit_t* nss_mtl_stats_log_limit(unsigned int cls);
+
+nss_mtl_stats_t* nss_mtl_stats_map(const char* path, bool create);
+void nss_mtl_stats_unmap(nss_mtl_stats_t* stats);
+void nss_mtl_stats_reset(nss_mtl_stats_t* stats);
+void nss_mtl_stats_sum(const nss_mtl_stats_t* stats, nss_mtl_stats_op_t op, nss_mtl_stats_total_t* total);
+const char* nss_mtl_stats_op_name(nss_mtl_stats_op_t op);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* NSS_MTL_STATS_H */
\ No newline at end of file
@@ -20,83 +20,119 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <search.h>
+#include <errno.h>
+#include <stdatomic.h>
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <utmpx.h>
 #include <syslog.h>
 #include <pwd.h>
 
+#include "passwd.h"
+#include "probes.h"
+#include "stats.h"
 #include "utils.h"
 
-void nss_mtl_utils_list_fill(const void* node, VISIT which, void* closure);
-static void nss_mtl_utils_active_users_free(void* node);
+#define NSS_MTL_UTILS_UTMP_CHUNK 32
+#define NSS_MTL_UTILS_LOG_LINE_MAX 512
+#define NSS_MTL_UTILS_SET_INITIAL_SIZE 16
+#define NSS_MTL_UTILS_LIST_INITIAL_SIZE 16
 
-static void* nss_mtl_utils_local_users_get(void);
-static void nss_mtl_utils_local_users_free(void* users);
+static nss_mtl_utils_set_slot_t* nss_mtl_utils_set_find(const nss_mtl_utils_set_t* set, const char* str, size_t len, uint32_t hash);
+static bool nss_mtl_utils_set_grow(nss_mtl_utils_set_t* set);
 
 /* implementation */
 
-static int nss_mtl_utils_log_level = LOG_INFO;
+static atomic_int nss_mtl_utils_log_level = LOG_INFO;
+static atomic_uint nss_mtl_utils_log_rate_limit = NSS_MTL_UTILS_LOG_RATE_LIMIT;
+/* used by processes which cannot write the stats file */
+static nss_mtl_stats_log_limit_t nss_mtl_utils_log_limits[NSS_MTL_UTILS_LOG_CLASSES];
 
-void nss_mtl_utils_tree_size_calc(const void* node, VISIT which, void* closure) {
-	(void)node;
-
-	if (which != postorder && which != leaf) {
-		return;
+nss_mtl_utils_set_t* nss_mtl_utils_set_alloc(nss_mtl_arena_t* arena) {
+	nss_mtl_utils_set_t* set = nss_mtl_arena_alloc(arena, sizeof(nss_mtl_utils_set_t));
+	nss_mtl_utils_set_slot_t* slots = set != NULL ? nss_mtl_arena_calloc(arena, NSS_MTL_UTILS_SET_INITIAL_SIZE, sizeof(nss_mtl_utils_set_slot_t)) : NULL;
+	if (slots == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate hash set", __func__);
+		return NULL;
 	}
+	set->arena = arena;
+	set->count = 0;
+	set->mask = NSS_MTL_UTILS_SET_INITIAL_SIZE - 1;
+	set->slots = slots;
 
-	size_t* size = (size_t*)closure;
-	*size += 1;
+	return set;
 }
 
-void nss_mtl_utils_list_fill(const void* node, VISIT which, void* closure) {
-	if (which != postorder && which != leaf) {
-		return;
+nss_mtl_utils_set_slot_t* nss_mtl_utils_set_find(const nss_mtl_utils_set_t* set, const char* str, size_t len, uint32_t hash) {
+	/* linear probing, returns either matching slot or the empty one ending the sequence */
+	size_t pos = hash & set->mask;
+	while (set->slots[pos].item != NULL) {
+		const nss_mtl_utils_set_slot_t* slot = &set->slots[pos];
+		if (slot->hash == hash && strncmp(slot->item, str, len) == 0 && slot->item[len] == '\0') {
+			break;
+		}
+		pos = (pos + 1) & set->mask;
 	}
 
-	nss_mtl_utils_list_t* lst = (nss_mtl_utils_list_t*)closure;
-	char** value = (char**)node;
-
-	lst->items[lst->filled++] = *value;
+	return &set->slots[pos];
 }
 
-void nss_mtl_utils_active_users_free(void* node) {
-	/* do nothing */
-	(void)node;
-}
+bool nss_mtl_utils_set_grow(nss_mtl_utils_set_t* set) {
+	const size_t size = 2 * (set->mask + 1);
+	nss_mtl_utils_set_slot_t* slots = nss_mtl_arena_calloc(set->arena, size, sizeof(nss_mtl_utils_set_slot_t));
+	if (slots == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate hash set of size %lu", __func__, size);
+		return false;
+	}
+
+	/* old slots stay in the arena, they take less than the new ones */
+	nss_mtl_utils_set_t grown = { set->arena, set->count, size - 1, slots };
+	for (size_t i = 0; i <= set->mask; ++i) {
+		const nss_mtl_utils_set_slot_t* slot = &set->slots[i];
+		if (slot->item != NULL) {
+			*nss_mtl_utils_set_find(&grown, slot->item, strlen(slot->item), slot->hash) = *slot;
+		}
+	}
+	*set = grown;
 
-void* nss_mtl_utils_local_users_get() {
-	void* local = NULL;
+	return true;
+}
 
-	FILE* f = fopen(NSS_MTL_PASSWD_FILE, "r");
-	if (f == NULL) {
-		nss_mtl_utils_log(LOG_ERR, "%s: failed to open %s for reading: %m", __func__, NSS_MTL_PASSWD_FILE);
+nss_mtl_utils_set_slot_t* nss_mtl_utils_set_add(nss_mtl_utils_set_t* set, const char* str, size_t len, bool* added) {
+	/* keep load factor at or below 50% so that probe sequences stay short */
+	if (2 * (set->count + 1) > set->mask + 1 && ! nss_mtl_utils_set_grow(set)) {
 		return NULL;
 	}
 
-	struct passwd* pw = NULL;
-	while ((pw = fgetpwent(f)) != NULL) {
-		char* name = strdup(pw->pw_name);
-		char** node = tsearch(name, &local, nss_mtl_utils_str_cmp);
-		if (node == NULL || *node != name) {
-			free(name);
+	const uint32_t hash = nss_mtl_utils_hash(str, len);
+	nss_mtl_utils_set_slot_t* slot = nss_mtl_utils_set_find(set, str, len, hash);
+	*added = slot->item == NULL;
+	if (*added) {
+		slot->item = nss_mtl_arena_strndup(set->arena, str, len);
+		if (slot->item == NULL) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate hash set item", __func__);
+			return NULL;
 		}
+		slot->hash = hash;
+		slot->value = 0;
+		set->count += 1;
 	}
 
-	fclose(f);
-
-	return local;
+	return slot;
 }
 
-void nss_mtl_utils_local_users_free(void* users) {
-	tdestroy(users, free);
+const nss_mtl_utils_set_slot_t* nss_mtl_utils_set_get(const nss_mtl_utils_set_t* set, const char* str) {
+	const size_t len = strlen(str);
+	const nss_mtl_utils_set_slot_t* slot = nss_mtl_utils_set_find(set, str, len, nss_mtl_utils_hash(str, len));
+	return slot->item != NULL ? slot : NULL;
 }
 
-int nss_mtl_utils_str_cmp(const void* a, const void* b) {
-	const char* sa = a;
-	const char* sb = b;
-	return strcmp(sa, sb);
+bool nss_mtl_utils_set_contains(const nss_mtl_utils_set_t* set, const char* str) {
+	return nss_mtl_utils_set_get(set, str) != NULL;
 }
 
 int nss_mtl_utils_strptr_cmp(const void* a, const void* b) {
@@ -106,91 +142,319 @@ int nss_mtl_utils_strptr_cmp(const void* a, const void* b) {
 	return strcmp(*ptr_a, *ptr_b);
 }
 
-nss_mtl_utils_list_t* nss_mtl_utils_users_get(void) {
-	void* local = nss_mtl_utils_local_users_get();
+uint32_t nss_mtl_utils_hash(const char* str, size_t len) {
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
 
-	setutxent();
+bool nss_mtl_utils_span_eq(const nss_mtl_utils_span_t* span, const char* str, size_t len) {
+	return span->length == len && memcmp(span->start, str, len) == 0;
+}
+
+bool nss_mtl_utils_span_id(const nss_mtl_utils_span_t* span, unsigned long* id) {
+	char buffer[24];
+	if (span->length == 0 || span->length >= sizeof(buffer)) {
+		return false;
+	}
+	memcpy(buffer, span->start, span->length);
+	buffer[span->length] = '\0';
+
+	char* end = NULL;
+	errno = 0;
+	*id = strtoul(buffer, &end, 10);
+
+	return errno == 0 && *end == '\0';
+}
 
-	void* active = NULL;
-	struct utmpx* rec = NULL;
-	while ((rec = getutxent()) != NULL) {
-		if (rec->ut_type != USER_PROCESS) {
-			continue;
+bool nss_mtl_utils_span_has_item(const nss_mtl_utils_span_t* span, char delimiter, const char* item, size_t len) {
+	if (len == 0) {
+		return false;
+	}
+
+	const char* pos = span->start;
+	const char* end = span->start + span->length;
+	while ((size_t)(end - pos) >= len) {
+		const char* found = memmem(pos, end - pos, item, len);
+		if (found == NULL) {
+			return false;
 		}
-		if (tfind(rec->ut_user, &local, nss_mtl_utils_str_cmp) != NULL) {
-			nss_mtl_utils_log(LOG_DEBUG, "%s: ignoring local user %s", __func__, rec->ut_user);
-			continue;
+		const char* found_end = found + len;
+		if ((found == span->start || found[-1] == delimiter) && (found_end == end || *found_end == delimiter)) {
+			return true;
 		}
-		char* name = strdup(rec->ut_user);
-		char** node = tsearch(name, &active, nss_mtl_utils_str_cmp);
-		if (node == NULL) {
-			nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for user %s", __func__, name);
-			free(name);
-			nss_mtl_utils_local_users_free(local);
-			return NULL;
-		} else if (*node != name) {
-			/* username not unique */
-			free(name);
-		} else {
-			nss_mtl_utils_log(LOG_DEBUG, "%s: found user %s", __func__, name);
+		pos = found + 1;
+	}
+
+	return false;
+}
+
+size_t nss_mtl_utils_span_split(const nss_mtl_utils_span_t* span, char delimiter, nss_mtl_utils_span_t* fields, size_t max) {
+	const char* pos = span->start;
+	const char* end = span->start + span->length;
+
+	size_t count = 0;
+	while (count < max) {
+		const char* next = memchr(pos, delimiter, end - pos);
+		fields[count].start = pos;
+		fields[count].length = (next != NULL ? next : end) - pos;
+		++count;
+		if (next == NULL) {
+			return count;
+		}
+		pos = next + 1;
+	}
+
+	/* more fields than requested */
+	return max + 1;
+}
+
+bool nss_mtl_utils_file_map(const char* path, const char** data, size_t* size) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		nss_mtl_utils_log(LOG_ERR, "%s: failed to open %s for reading: %m", __func__, path);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot stat %s: %m", __func__, path);
+		close(fd);
+		return false;
+	}
+
+	*data = NULL;
+	*size = st.st_size;
+	if (*size > 0) {
+		void* addr = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED) {
+			nss_mtl_utils_log(LOG_ERR, "%s: cannot map %s: %m", __func__, path);
+			close(fd);
+			return false;
 		}
+		*data = addr;
 	}
 
-	endutxent();
+	close(fd);
+	return true;
+}
 
-	nss_mtl_utils_local_users_free(local);
+void nss_mtl_utils_file_unmap(const char* data, size_t size) {
+	if (data != NULL) {
+		munmap((void*)data, size);
+	}
+}
+
+nss_mtl_utils_list_t* nss_mtl_utils_users_get(nss_mtl_arena_t* arena) {
+	const nss_mtl_passwd_t* local = nss_mtl_passwd_acquire();
+	if (local == NULL) {
+		return NULL;
+	}
 
-	size_t size = 0;
-	twalk_r(active, nss_mtl_utils_tree_size_calc, &size);
-	nss_mtl_utils_log(LOG_DEBUG, "%s: found %lu active users", __func__, size);
+	nss_mtl_utils_list_t* lst = nss_mtl_utils_users_read(local, arena);
+	nss_mtl_passwd_release(local);
 
-	nss_mtl_utils_list_t* lst = nss_mtl_utils_list_alloc(size);;
+	return lst;
+}
+
+nss_mtl_utils_list_t* nss_mtl_utils_users_read(const nss_mtl_passwd_t* local, nss_mtl_arena_t* arena) {
+	NSS_MTL_PROBE1(utmp_read_entry, NSS_MTL_UTMP_FILE);
+	const uint64_t started = nss_mtl_stats_begin();
+	size_t bytes = 0;
+
+	/* utmp is read directly instead of getutxent() to keep its global state intact */
+	int fd = open(NSS_MTL_UTMP_FILE, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 && errno != ENOENT) {
+		nss_mtl_utils_log(LOG_ERR, "%s: failed to open %s for reading: %m", __func__, NSS_MTL_UTMP_FILE);
+		NSS_MTL_PROBE4(utmp_read_return, NSS_MTL_UTMP_FILE, false, 0, bytes);
+		return NULL;
+	}
+
+	nss_mtl_utils_list_t* lst = nss_mtl_utils_list_alloc(arena, NSS_MTL_UTILS_LIST_INITIAL_SIZE);
 	if (lst == NULL) {
-		tdestroy(active, nss_mtl_utils_active_users_free);
+		if (fd != -1) {
+			close(fd);
+		}
+		NSS_MTL_PROBE4(utmp_read_return, NSS_MTL_UTMP_FILE, false, 0, bytes);
+		return NULL;
+	}
+
+	struct utmpx records[NSS_MTL_UTILS_UTMP_CHUNK];
+	ssize_t got = 0;
+	while (fd != -1 && (got = read(fd, records, sizeof(records))) > 0) {
+		const size_t count = got / sizeof(struct utmpx);
+		bytes += got;
+		for (size_t i = 0; i < count; ++i) {
+			const struct utmpx* rec = &records[i];
+			if (rec->ut_type != USER_PROCESS) {
+				continue;
+			}
+			char user[sizeof(rec->ut_user) + 1];
+			memcpy(user, rec->ut_user, sizeof(rec->ut_user));
+			user[sizeof(rec->ut_user)] = '\0';
+			if (nss_mtl_passwd_contains(local, user)) {
+				nss_mtl_utils_log(LOG_DEBUG, "%s: ignoring local user %s", __func__, user);
+				continue;
+			}
+			if (! nss_mtl_utils_list_add(lst, user, strlen(user))) {
+				nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer for user %s", __func__, user);
+				close(fd);
+				NSS_MTL_PROBE4(utmp_read_return, NSS_MTL_UTMP_FILE, false, lst->filled, bytes);
+				return NULL;
+			}
+		}
+	}
+
+	if (got == -1) {
+		nss_mtl_utils_log(LOG_ERR, "%s: failed to read %s: %m", __func__, NSS_MTL_UTMP_FILE);
+		close(fd);
+		NSS_MTL_PROBE4(utmp_read_return, NSS_MTL_UTMP_FILE, false, lst->filled, bytes);
 		return NULL;
 	}
+	if (fd != -1) {
+		close(fd);
+	}
 
-	twalk_r(active, nss_mtl_utils_list_fill, lst);
-	tdestroy(active, nss_mtl_utils_active_users_free);
+	/* same user may have several sessions */
+	nss_mtl_utils_list_uniq(lst);
+	nss_mtl_utils_log(LOG_DEBUG, "%s: found %lu active users", __func__, lst->filled);
+	nss_mtl_stats_record(NSS_MTL_STATS_UTMP_READ, started, NSS_MTL_STATS_SUCCESS, bytes);
+	NSS_MTL_PROBE4(utmp_read_return, NSS_MTL_UTMP_FILE, true, lst->filled, bytes);
 
 	return lst;
 }
 
-nss_mtl_utils_list_t* nss_mtl_utils_list_alloc(size_t nmemb) {
-	const size_t size = sizeof(nss_mtl_utils_list_t) + nmemb * sizeof(char*);
-	nss_mtl_utils_list_t* res = malloc(size);
-	if (res == NULL) {
-		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate buffer of size %ld", __func__, size);
-	} else {
-		res->size = nmemb;
-		res->filled = 0;
-		memset(res->items, 0, nmemb * sizeof(char*));
+nss_mtl_utils_list_t* nss_mtl_utils_list_alloc(nss_mtl_arena_t* arena, size_t nmemb) {
+	nss_mtl_utils_list_t* res = nss_mtl_arena_alloc(arena, sizeof(nss_mtl_utils_list_t));
+	char** items = res != NULL ? nss_mtl_arena_calloc(arena, nmemb > 0 ? nmemb : 1, sizeof(char*)) : NULL;
+	if (items == NULL) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot allocate list of %lu items", __func__, nmemb);
+		return NULL;
 	}
+	res->arena = arena;
+	res->size = nmemb > 0 ? nmemb : 1;
+	res->filled = 0;
+	res->items = items;
 
 	return res;
 }
 
-void nss_mtl_utils_list_free(nss_mtl_utils_list_t* lst) {
-	if (lst == NULL) {
-		return;
+bool nss_mtl_utils_list_add(nss_mtl_utils_list_t* lst, const char* str, size_t len) {
+	if (lst->filled == lst->size) {
+		/* old items stay in the arena, they take less than the new ones */
+		char** items = nss_mtl_arena_calloc(lst->arena, 2 * lst->size, sizeof(char*));
+		if (items == NULL) {
+			return false;
+		}
+		memcpy(items, lst->items, lst->filled * sizeof(char*));
+		lst->items = items;
+		lst->size *= 2;
+	}
+
+	char* item = nss_mtl_arena_strndup(lst->arena, str, len);
+	if (item == NULL) {
+		return false;
 	}
+	lst->items[lst->filled++] = item;
 
+	return true;
+}
+
+void nss_mtl_utils_list_uniq(nss_mtl_utils_list_t* lst) {
+	qsort(lst->items, lst->filled, sizeof(char*), nss_mtl_utils_strptr_cmp);
+	size_t unique = 0;
 	for (size_t i = 0; i < lst->filled; ++i) {
-		free(lst->items[i]);
+		if (unique == 0 || strcmp(lst->items[unique - 1], lst->items[i]) != 0) {
+			lst->items[unique++] = lst->items[i];
+		}
 	}
+	lst->filled = unique;
+}
 
-	free(lst);
+void nss_mtl_utils_stamp_fill(nss_mtl_utils_stamp_t* stamp, const struct stat* st) {
+	memset(stamp, 0, sizeof(nss_mtl_utils_stamp_t));
+	stamp->dev = st->st_dev;
+	stamp->ino = st->st_ino;
+	stamp->size = st->st_size;
+	stamp->mtime = st->st_mtim;
 }
 
-void nss_mtl_utils_log_setup(int log_level) {
-	nss_mtl_utils_log_level = log_level;
+bool nss_mtl_utils_stamp_read(const char* path, nss_mtl_utils_stamp_t* stamp) {
+	struct stat st;
+	if (stat(path, &st) == -1) {
+		nss_mtl_utils_log(LOG_ERR, "%s: cannot stat %s: %m", __func__, path);
+		return false;
+	}
+
+	nss_mtl_utils_stamp_fill(stamp, &st);
+	return true;
+}
+
+bool nss_mtl_utils_stamp_equal(const nss_mtl_utils_stamp_t* a, const nss_mtl_utils_stamp_t* b) {
+	return a->dev == b->dev
+		&& a->ino == b->ino
+		&& a->size == b->size
+		&& a->mtime.tv_sec == b->mtime.tv_sec
+		&& a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+void nss_mtl_utils_log_setup(int log_level, unsigned int rate_limit) {
+	atomic_store_explicit(&nss_mtl_utils_log_level, log_level, memory_order_relaxed);
+	atomic_store_explicit(&nss_mtl_utils_log_rate_limit, rate_limit, memory_order_relaxed);
 }
 
 void nss_mtl_utils_log(int level, const char* fmt, ...) {
-	if (level <= nss_mtl_utils_log_level) {
+	if (level <= atomic_load_explicit(&nss_mtl_utils_log_level, memory_order_relaxed)) {
 		va_list args;
 		va_start(args, fmt);
 		vsyslog(level, fmt, args);
 		va_end(args);
 	}
+}
+
+void nss_mtl_utils_log_limited(nss_mtl_utils_log_class_t cls, int level, const char* fmt, ...) {
+	if (level > atomic_load_explicit(&nss_mtl_utils_log_level, memory_order_relaxed)) {
+		return;
+	}
+
+	/* short-lived processes would each log their first message, so limits are shared through the stats file */
+	nss_mtl_stats_log_limit_t* limit = nss_mtl_stats_log_limit(cls);
+	if (limit == NULL) {
+		limit = &nss_mtl_utils_log_limits[cls];
+	}
+	const unsigned int rate_limit = atomic_load_explicit(&nss_mtl_utils_log_rate_limit, memory_order_relaxed);
+	long elapsed = 0;
+	if (rate_limit > 0) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		/* shifted, so that 0 is never a valid window; monotonic clock is the same in every process */
+		const long now = ts.tv_sec + 1;
+
+		/* only the thread which opens new interval logs, others just count */
+		long window = atomic_load_explicit(&limit->window, memory_order_relaxed);
+		if ((window != 0 && now - window < rate_limit)
+			|| !atomic_compare_exchange_strong_explicit(&limit->window, &window, now, memory_order_relaxed, memory_order_relaxed)) {
+			atomic_fetch_add_explicit(&limit->suppressed, 1, memory_order_relaxed);
+			return;
+		}
+		elapsed = window != 0 ? now - window : 0;
+	}
+
+	char line[NSS_MTL_UTILS_LOG_LINE_MAX];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	const unsigned long suppressed = atomic_exchange_explicit(&limit->suppressed, 0, memory_order_relaxed);
+	if (suppressed > 0) {
+		syslog(level, "%s (%lu similar messages suppressed in last %ld s)", line, suppressed, elapsed);
+	} else {
+		syslog(level, "%s", line);
+	}
 }
\ No newline at end of file
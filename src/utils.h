@@ -21,35 +21,113 @@
 #define NSS_MTL_UTILS_H
 
 #include <stdarg.h>
-#include <search.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "arena.h"
 
 #ifndef NSS_MTL_PASSWD_FILE
 #define NSS_MTL_PASSWD_FILE "/etc/passwd"
 #endif
 
+#ifndef NSS_MTL_UTMP_FILE
+#define NSS_MTL_UTMP_FILE "/var/run/utmp"
+#endif
+
+/* default for log_rate_limit, in seconds */
+#define NSS_MTL_UTILS_LOG_RATE_LIMIT 60
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* messages which can be repeated on every lookup and are rate limited */
+typedef enum {
+	NSS_MTL_UTILS_LOG_IGNORED = 0,
+	NSS_MTL_UTILS_LOG_ERANGE,
+	NSS_MTL_UTILS_LOG_DAEMON,
+	NSS_MTL_UTILS_LOG_CLASSES,
+} nss_mtl_utils_log_class_t;
+
+/* list of strings living in the arena of whatever owns the list */
 typedef struct {
+	nss_mtl_arena_t* arena;
 	size_t size;
 	size_t filled;
-	char* items[];
+	char** items;
 } nss_mtl_utils_list_t;
 
-void nss_mtl_utils_tree_size_calc(const void* node, VISIT which, void* closure);
-void nss_mtl_utils_list_fill(const void* node, VISIT which, void* closure);
+/* non NUL-terminated fragment of a larger buffer */
+typedef struct {
+	const char* start;
+	size_t length;
+} nss_mtl_utils_span_t;
+
+typedef struct {
+	uint32_t hash;
+	/* whatever the owner associates with the item, 0 for new ones */
+	uint32_t value;
+	char* item;
+} nss_mtl_utils_set_slot_t;
+
+/* open addressing hash set of strings, slots with NULL item are empty, all kept in the arena */
+typedef struct {
+	nss_mtl_arena_t* arena;
+	size_t count;
+	size_t mask;
+	nss_mtl_utils_set_slot_t* slots;
+} nss_mtl_utils_set_t;
+
+/* identity of a file used to detect that cached data went stale */
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+} nss_mtl_utils_stamp_t;
+
+struct nss_mtl_passwd;
+
+nss_mtl_utils_list_t* nss_mtl_utils_list_alloc(nss_mtl_arena_t* arena, size_t nmemb);
+bool nss_mtl_utils_list_add(nss_mtl_utils_list_t* lst, const char* str, size_t len);
+void nss_mtl_utils_list_uniq(nss_mtl_utils_list_t* lst);
 
-nss_mtl_utils_list_t* nss_mtl_utils_list_alloc(size_t nmemb);
-void nss_mtl_utils_list_free(nss_mtl_utils_list_t* lst);
+nss_mtl_utils_set_t* nss_mtl_utils_set_alloc(nss_mtl_arena_t* arena);
+nss_mtl_utils_set_slot_t* nss_mtl_utils_set_add(nss_mtl_utils_set_t* set, const char* str, size_t len, bool* added);
+const nss_mtl_utils_set_slot_t* nss_mtl_utils_set_get(const nss_mtl_utils_set_t* set, const char* str);
+bool nss_mtl_utils_set_contains(const nss_mtl_utils_set_t* set, const char* str);
 
-int nss_mtl_utils_str_cmp(const void* a, const void* b);
 int nss_mtl_utils_strptr_cmp(const void* a, const void* b);
 
-nss_mtl_utils_list_t* nss_mtl_utils_users_get(void);
+uint32_t nss_mtl_utils_hash(const char* str, size_t len);
+bool nss_mtl_utils_span_eq(const nss_mtl_utils_span_t* span, const char* str, size_t len);
+bool nss_mtl_utils_span_id(const nss_mtl_utils_span_t* span, unsigned long* id);
+bool nss_mtl_utils_span_has_item(const nss_mtl_utils_span_t* span, char delimiter, const char* item, size_t len);
+size_t nss_mtl_utils_span_split(const nss_mtl_utils_span_t* span, char delimiter, nss_mtl_utils_span_t* fields, size_t max);
 
-void nss_mtl_utils_log_setup(int log_level);
+bool nss_mtl_utils_file_map(const char* path, const char** data, size_t* size);
+void nss_mtl_utils_file_unmap(const char* data, size_t size);
+
+nss_mtl_utils_list_t* nss_mtl_utils_users_get(nss_mtl_arena_t* arena);
+nss_mtl_utils_list_t* nss_mtl_utils_users_read(const struct nss_mtl_passwd* local, nss_mtl_arena_t* arena);
+
+void nss_mtl_utils_stamp_fill(nss_mtl_utils_stamp_t* stamp, const struct stat* st);
+bool nss_mtl_utils_stamp_read(const char* path, nss_mtl_utils_stamp_t* stamp);
+bool nss_mtl_utils_stamp_equal(const nss_mtl_utils_stamp_t* a, const nss_mtl_utils_stamp_t* b);
+
+void nss_mtl_utils_log_setup(int log_level, unsigned int rate_limit);
 void nss_mtl_utils_log(int level, const char* fmt, ...);
+/*
+ * Logs at most one message of given class per rate limit interval, the
+ * following ones are only counted and their number is appended to the
+ * first message of the next interval. Interval and count are shared by all
+ * processes able to write the stats file, others keep their own.
+ */
+void nss_mtl_utils_log_limited(nss_mtl_utils_log_class_t cls, int level, const char* fmt, ...);
 
 #ifdef __cplusplus
 } /* extern "C" */